@@ -0,0 +1,435 @@
+#include "aot.h"
+
+#include <iostream>
+#include <set>
+#include <unordered_set>
+
+#include "compiler.h"
+#include "verifier.h"
+
+namespace lox {
+
+namespace {
+
+uint16_t shortAt(Chunk const &chunk, size_t offset) {
+  return static_cast<uint16_t>((chunk.codes[offset] << 8) |
+                               chunk.codes[offset + 1]);
+}
+
+// Offsets that some jump in the chunk lands on, which need a label.
+std::set<size_t> jumpTargets(Chunk const &chunk) {
+  std::set<size_t> targets;
+  for (size_t offset = 0; offset < chunk.codes.size();) {
+    uint8_t op = chunk.codes[offset];
+    size_t end = offset + instructionLength(op);
+    if (op == OP_JUMP || op == OP_JUMP_IF_FALSE) {
+      targets.insert(end + shortAt(chunk, offset + 1));
+    } else if (op == OP_LOOP) {
+      targets.insert(end - shortAt(chunk, offset + 1));
+    }
+    offset = end;
+  }
+  return targets;
+}
+
+// A C++ string literal holding text, one source line per literal.
+void emitStringLiteral(std::ostream &out, std::string const &text) {
+  static char const digits[] = "01234567";
+  out << "    \"";
+  for (size_t i = 0; i < text.size(); i++) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    if (c == '\n') {
+      out << "\\n\"";
+      if (i + 1 < text.size()) {
+        out << "\n    \"";
+      }
+      continue;
+    }
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c >= 0x20 && c < 0x7f && c != '?') {
+      out << c;
+    } else {
+      // Octal escapes are at most three digits, so they can't run into
+      // the next character. '?' is escaped to rule out trigraphs.
+      out << '\\' << digits[c >> 6] << digits[(c >> 3) & 7] << digits[c & 7];
+    }
+  }
+  if (text.empty() || text.back() != '\n') {
+    out << '"';
+  }
+}
+
+class Emitter {
+public:
+  Emitter(std::ostream &out, ObjFunction *function, size_t index)
+      : out{out}, function{function}, chunk{function->chunk}, index{index} {}
+
+  void run();
+
+private:
+  std::ostream &out;
+  ObjFunction *function;
+  Chunk const &chunk;
+  size_t index;
+
+  std::string ip(size_t offset) const {
+    return "code + " + std::to_string(offset);
+  }
+  void instruction(size_t offset);
+};
+
+void Emitter::run() {
+  out << "\n// " << (function->name.empty() ? "script" : function->name)
+      << "\n";
+  out << "lox::Value function" << index
+      << "(lox::AotRuntime &rt, lox::ObjFunction *function,\n"
+      << "                      [[maybe_unused]] lox::Value *slots) {\n";
+  out << "  [[maybe_unused]] lox::Value const *k = "
+         "function->chunk.constants.data();\n";
+  out << "  [[maybe_unused]] lox::InlineCache *caches = "
+         "function->chunk.caches.data();\n";
+  out << "  [[maybe_unused]] std::uint8_t *code = "
+         "function->chunk.codes.data();\n";
+
+  std::set<size_t> targets = jumpTargets(chunk);
+  for (size_t offset = 0; offset < chunk.codes.size();
+       offset += instructionLength(chunk.codes[offset])) {
+    if (targets.count(offset) != 0) {
+      out << "L" << offset << ":\n";
+    }
+    instruction(offset);
+  }
+  if (targets.count(chunk.codes.size()) != 0) {
+    out << "L" << chunk.codes.size() << ":;\n";
+  }
+  out << "}\n";
+}
+
+void Emitter::instruction(size_t offset) {
+  uint8_t op = chunk.codes[offset];
+  size_t end = offset + instructionLength(op);
+  int byte = offset + 1 < chunk.codes.size() ? chunk.codes[offset + 1] : 0;
+  std::string at = ip(offset + 1);
+  out << "  ";
+
+  switch (op) {
+  case OP_CONSTANT:
+    out << "rt.push(k[" << byte << "]);";
+    break;
+  case OP_NIL:
+    out << "rt.push(lox::Nil{});";
+    break;
+  case OP_TRUE:
+    out << "rt.push(true);";
+    break;
+  case OP_FALSE:
+    out << "rt.push(false);";
+    break;
+  case OP_EQUAL:
+    out << "rt.equal();";
+    break;
+  case OP_GREATER:
+    out << "rt.binary<lox::NumberOp::Greater>(" << at << ");";
+    break;
+  case OP_LESS:
+    out << "rt.binary<lox::NumberOp::Less>(" << at << ");";
+    break;
+  case OP_ADD:
+    out << "rt.add(" << at << ");";
+    break;
+  case OP_SUBTRACT:
+    out << "rt.binary<lox::NumberOp::Subtract>(" << at << ");";
+    break;
+  case OP_MULTIPLY:
+    out << "rt.binary<lox::NumberOp::Multiply>(" << at << ");";
+    break;
+  case OP_DIVIDE:
+    out << "rt.binary<lox::NumberOp::Divide>(" << at << ");";
+    break;
+  case OP_NOT:
+    out << "rt.logicalNot();";
+    break;
+  case OP_NEGATE:
+    out << "rt.negate(" << at << ");";
+    break;
+  case OP_PRINT:
+    out << "rt.print();";
+    break;
+  case OP_POP:
+    out << "rt.drop(1);";
+    break;
+  case OP_POPN:
+    out << "rt.drop(" << byte << ");";
+    break;
+  case OP_DEFINE_GLOBAL:
+    out << "rt.defineGlobal(" << shortAt(chunk, offset + 1) << ");";
+    break;
+  case OP_GET_GLOBAL:
+    out << "rt.getGlobal(" << shortAt(chunk, offset + 1) << ", " << at
+        << ");";
+    break;
+  case OP_SET_GLOBAL:
+    out << "rt.setGlobal(" << shortAt(chunk, offset + 1) << ", " << at
+        << ");";
+    break;
+  case OP_GET_LOCAL:
+    out << "rt.push(slots[" << byte << "]);";
+    break;
+  case OP_SET_LOCAL:
+    out << "slots[" << byte << "] = rt.top();";
+    break;
+  case OP_GET_LOCAL_LONG:
+    out << "rt.push(slots[" << shortAt(chunk, offset + 1) << "]);";
+    break;
+  case OP_SET_LOCAL_LONG:
+    out << "slots[" << shortAt(chunk, offset + 1) << "] = rt.top();";
+    break;
+  case OP_JUMP:
+    out << "goto L" << end + shortAt(chunk, offset + 1) << ";";
+    break;
+  case OP_JUMP_IF_FALSE:
+    out << "if (rt.falsey()) {\n"
+        << "    goto L" << end + shortAt(chunk, offset + 1) << ";\n  }";
+    break;
+  case OP_LOOP:
+    out << "goto L" << end - shortAt(chunk, offset + 1) << ";";
+    break;
+  case OP_CALL:
+    out << "rt.call(" << byte << ", " << ip(end) << ");";
+    break;
+  case OP_TAIL_CALL:
+    out << "if (rt.tailCall(" << byte << ", " << ip(end) << ")) {\n"
+        << "    return lox::Nil{};\n  }";
+    break;
+  case OP_CLASS:
+    out << "rt.defineClass(k[" << byte << "], " << at << ");";
+    break;
+  case OP_METHOD:
+    out << "rt.defineMethod(k[" << byte << "], " << at << ");";
+    break;
+  case OP_GET_PROPERTY:
+    out << "rt.getProperty(k[" << byte << "], caches["
+        << shortAt(chunk, offset + 2) << "], " << at << ");";
+    break;
+  case OP_SET_PROPERTY:
+    out << "rt.setProperty(k[" << byte << "], caches["
+        << shortAt(chunk, offset + 2) << "], " << at << ");";
+    break;
+  case OP_INVOKE:
+    out << "rt.invoke(k[" << byte << "], " << int{chunk.codes[offset + 2]}
+        << ", caches[" << shortAt(chunk, offset + 3) << "], " << ip(end)
+        << ");";
+    break;
+  case OP_RETURN:
+    out << "return rt.pop();";
+    break;
+  }
+  out << "\n";
+}
+
+} // namespace
+
+std::vector<ObjFunction *> scriptFunctions(ObjFunction *script) {
+  std::vector<ObjFunction *> functions;
+  std::unordered_set<ObjFunction *> seen;
+  std::vector<ObjFunction *> pending{script};
+  while (!pending.empty()) {
+    ObjFunction *function = pending.back();
+    pending.pop_back();
+    if (!seen.insert(function).second) {
+      continue;
+    }
+    functions.push_back(function);
+    auto &constants = function->chunk.constants;
+    for (auto constant = constants.rbegin(); constant != constants.rend();
+         ++constant) {
+      if (isFunction(*constant)) {
+        pending.push_back(asFunction(*constant));
+      }
+    }
+  }
+  return functions;
+}
+
+// FNV-1a over everything the generated code was derived from.
+uint64_t fingerprint(ObjFunction const *function) {
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&](uint8_t byte) {
+    hash ^= byte;
+    hash *= 1099511628211ull;
+  };
+  mix(static_cast<uint8_t>(function->arity));
+  for (char c : function->name) {
+    mix(static_cast<uint8_t>(c));
+  }
+  for (uint8_t byte : function->chunk.codes) {
+    mix(byte);
+  }
+  return hash;
+}
+
+bool emitCpp(std::string const &src, std::ostream &out) {
+  // A fresh VM has the same natives, and so the same globals, as the one
+  // the generated program will create.
+  VM vm;
+  ObjFunction *script = AotRuntime{vm}.compile(src);
+  if (script == nullptr) {
+    return false;
+  }
+
+  std::vector<ObjFunction *> functions = scriptFunctions(script);
+  out << "// Generated by cpplox --emit-cpp. Do not edit.\n"
+      << "#include <cstdint>\n"
+      << "#include <functional>\n\n"
+      << "#include \"aot.h\"\n\n"
+      << "namespace {\n\n"
+      << "char const SOURCE[] =\n";
+  emitStringLiteral(out, src);
+  out << ";\n";
+
+  for (size_t i = 0; i < functions.size(); i++) {
+    Emitter{out, functions[i], i}.run();
+  }
+
+  out << "\nlox::AotFunction const FUNCTIONS[] = {\n";
+  for (size_t i = 0; i < functions.size(); i++) {
+    out << "    {function" << i << ", " << fingerprint(functions[i])
+        << "ull},\n";
+  }
+  out << "};\n\n"
+      << "} // namespace\n\n"
+      << "int main() {\n"
+      << "  return lox::aotMain(SOURCE, FUNCTIONS,\n"
+      << "                      sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]));\n"
+      << "}\n";
+  return true;
+}
+
+ObjFunction *AotRuntime::compile(std::string const &src) {
+  Parser parser{vm.globals, vm.heap, vm.out};
+  ObjFunction *script = nullptr;
+  try {
+    script = parser.compile(src);
+    // Sizes each chunk's stack, which calls check against.
+    if (script != nullptr) {
+      verifyFunction(script, vm.globals.size());
+    }
+  } catch (std::runtime_error &e) {
+    script = nullptr;
+    std::cerr << e.what() << "\n";
+  }
+  vm.out.flush();
+  return script;
+}
+
+InterpretResult AotRuntime::run(char const *src, AotFunction const *functions,
+                                size_t count) {
+  ObjFunction *script = compile(src);
+  if (script == nullptr) {
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  std::vector<ObjFunction *> scripted = scriptFunctions(script);
+  bool matches = scripted.size() == count;
+  for (size_t i = 0; matches && i < count; i++) {
+    matches = fingerprint(scripted[i]) == functions[i].fingerprint;
+    scripted[i]->compiled = functions[i].code;
+  }
+  if (!matches) {
+    vm.out.flush();
+    std::cerr << "Compiled code doesn't match this runtime's bytecode; "
+                 "regenerate it with --emit-cpp.\n";
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  vm.resetStack();
+  push(script);
+  try {
+    vm.call(script, 0);
+    runFrame();
+  } catch (std::runtime_error &e) {
+    vm.runtimeError(e.what());
+    vm.out.flush();
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  vm.out.flush();
+  return INTERPRET_OK;
+}
+
+// Runs the frame VM::call just pushed to completion, then pops it the way
+// OP_RETURN does.
+void AotRuntime::runFrame() {
+  CallFrame *frame = vm.frame;
+  Value result;
+  do {
+    this->tailCalled = false;
+    ObjFunction *function = frame->function;
+    if (function->compiled == nullptr) {
+      throw std::runtime_error("No compiled code for '" +
+                               std::string{function->name} + "'.");
+    }
+    result = function->compiled(*this, function, frame->slots);
+  } while (this->tailCalled);
+
+  Value *slots = frame->slots;
+  vm.frameCount--;
+  std::atomic_signal_fence(std::memory_order_release);
+  if (vm.frameCount == 0) {
+    vm.stackTop = vm.stack.data();
+    vm.frame = nullptr;
+    return;
+  }
+  vm.stackTop = slots;
+  push(result);
+  vm.frame = &vm.frames[vm.frameCount - 1];
+  vm.ip = vm.frame->ip;
+}
+
+// The VM does the work of every kind of call - arity and depth checks,
+// natives, classes, bound methods - and pushes a frame only when there is
+// a function body to run.
+void AotRuntime::call(int argCount, uint8_t *ip) {
+  vm.ip = ip;
+  size_t depth = vm.frameCount;
+  vm.callValue(top(argCount), argCount);
+  if (vm.frameCount != depth) {
+    runFrame();
+  }
+}
+
+bool AotRuntime::tailCall(int argCount, uint8_t *ip) {
+  Value callee = top(argCount);
+  if (!isFunction(callee) || asFunction(callee)->arity != argCount) {
+    call(argCount, ip);
+    return false;
+  }
+  vm.ip = ip;
+  vm.tailCall(argCount);
+  this->tailCalled = true;
+  return true;
+}
+
+void AotRuntime::invoke(Value name, int argCount, InlineCache &cache,
+                        uint8_t *ip) {
+  vm.ip = ip;
+  size_t depth = vm.frameCount;
+  vm.invoke(asString(name), argCount, cache);
+  if (vm.frameCount != depth) {
+    runFrame();
+  }
+}
+
+int aotMain(char const *src, AotFunction const *functions, size_t count) {
+  VM vm;
+  switch (AotRuntime{vm}.run(src, functions, count)) {
+  case INTERPRET_COMPILE_ERROR:
+    return 65;
+  case INTERPRET_RUNTIME_ERROR:
+    return 70;
+  default:
+    return 0;
+  }
+}
+
+} // namespace lox
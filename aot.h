@@ -0,0 +1,193 @@
+#ifndef cpplox_aot_h
+#define cpplox_aot_h
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "object.h"
+#include "vm.h"
+
+namespace lox {
+
+// Ahead-of-time compilation. `cpplox --emit-cpp out.cpp script.lox` turns
+// every function of a script into a C++ function: bytecode jumps become
+// gotos, operands stay on the VM's value stack, and each instruction is
+// an inline call into AotRuntime below. The generated file embeds the
+// script and defines main(); build it against the runtime library, e.g.
+//
+//   c++ -std=c++17 -O2 -I<cpplox> out.cpp <build>/libcpplox_runtime.a
+//
+// At startup the program compiles the embedded script once to recreate its
+// constants, classes and globals, checks each function's bytecode against
+// the fingerprint the C++ was generated from, and then runs only the
+// generated code. Compiled scripts run without an instruction budget.
+
+// One generated function and the fingerprint of the bytecode it came from.
+struct AotFunction {
+  CompiledFn code;
+  uint64_t fingerprint;
+};
+
+// Writes the C++ translation of src. Returns false if src doesn't compile.
+bool emitCpp(std::string const &src, std::ostream &out);
+
+// Every function in a script, the script first, in the order both the
+// emitter and the runtime number them.
+std::vector<ObjFunction *> scriptFunctions(ObjFunction *script);
+uint64_t fingerprint(ObjFunction const *function);
+
+// What generated code calls. Mirrors VM::run instruction by instruction,
+// including its error messages. Instructions that can fail take the
+// address just past their opcode so stack traces point at the right line.
+class AotRuntime {
+public:
+  explicit AotRuntime(VM &vm) : vm{vm} {}
+
+  // Compiles and verifies src in the VM. Reports errors and returns null
+  // if that fails.
+  ObjFunction *compile(std::string const &src);
+  InterpretResult run(char const *src, AotFunction const *functions,
+                      size_t count);
+
+  void push(Value value) { *vm.stackTop++ = value; }
+  Value pop() { return *--vm.stackTop; }
+  Value &top(int distance = 0) { return vm.stackTop[-1 - distance]; }
+  void drop(int count) { vm.stackTop -= count; }
+
+  // Inline versions of isFalsey and valuesEqual for the common cases.
+  bool falsey() {
+    bool const *boolean = std::get_if<bool>(&top());
+    return boolean != nullptr ? !*boolean
+                              : std::holds_alternative<Nil>(top());
+  }
+
+  void equal() {
+    int64_t const *b = std::get_if<int64_t>(&top(0));
+    int64_t const *a = std::get_if<int64_t>(&top(1));
+    Value result = a != nullptr && b != nullptr ? *a == *b
+                                                : valuesEqual(top(1), top(0));
+    drop(1);
+    top() = result;
+  }
+
+  template <NumberOp op> void binary(uint8_t *ip) {
+    if (!numberOp<op>(top(1), top(0), top(1))) {
+      fail(ip, "Operand must be a number.");
+    }
+    drop(1);
+  }
+
+  void add(uint8_t *ip) {
+    if (!isNumber(top(0)) && isString(top(0)) && isString(top(1))) {
+      vm.ip = ip;
+      vm.concatenate();
+      return;
+    }
+    binary<NumberOp::Add>(ip);
+  }
+
+  void negate(uint8_t *ip) {
+    if (!negateNumber(top(), top())) {
+      fail(ip, "Operand must be a number.");
+    }
+  }
+
+  void logicalNot() { top() = falsey(); }
+
+  void print() {
+    printValue(vm.out, pop());
+    vm.out.put('\n');
+  }
+
+  void defineGlobal(uint16_t index) {
+    Global &global = vm.globals[index];
+    global.value = pop();
+    global.defined = true;
+  }
+
+  void getGlobal(uint16_t index, uint8_t *ip) {
+    push(definedGlobal(index, ip).value);
+  }
+
+  void setGlobal(uint16_t index, uint8_t *ip) {
+    definedGlobal(index, ip).value = top();
+  }
+
+  void call(int argCount, uint8_t *ip);
+  // Returns true if the caller should return so its frame can be reused.
+  bool tailCall(int argCount, uint8_t *ip);
+  void invoke(Value name, int argCount, InlineCache &cache, uint8_t *ip);
+
+  void defineClass(Value name, uint8_t *ip) {
+    vm.ip = ip;
+    push(vm.heap.allocate<ObjClass>(asString(name)));
+  }
+  void defineMethod(Value name, uint8_t *ip) {
+    vm.ip = ip;
+    vm.defineMethod(asString(name));
+  }
+
+  void getProperty(Value name, InlineCache &cache, uint8_t *ip) {
+    if (!isInstance(top())) {
+      fail(ip, "Only instances have properties.");
+    }
+    ObjInstance *instance = asInstance(top());
+    CacheEntry const *entry = cache.find(instance->shape);
+    if (entry != nullptr && entry->method == nullptr) {
+      top() = instance->fields[entry->slot];
+      return;
+    }
+    vm.ip = ip;
+    vm.getProperty(asString(name), cache);
+  }
+
+  void setProperty(Value name, InlineCache &cache, uint8_t *ip) {
+    if (!isInstance(top(1))) {
+      fail(ip, "Only instances have fields.");
+    }
+    ObjInstance *instance = asInstance(top(1));
+    CacheEntry const *entry = cache.find(instance->shape);
+    vm.ip = ip;
+    if (entry != nullptr && entry->transition == nullptr) {
+      instance->fields[entry->slot] = top();
+    } else if (entry != nullptr) {
+      instance->shape = entry->transition;
+      instance->fields.push_back(top());
+    } else {
+      vm.setProperty(asString(name), cache);
+    }
+    Value value = pop();
+    top() = value;
+  }
+
+  [[noreturn]] void fail(uint8_t *ip, std::string const &message) {
+    vm.ip = ip;
+    throw std::runtime_error(message);
+  }
+
+private:
+  VM &vm;
+  // Set by tailCall when the running frame now belongs to its callee.
+  bool tailCalled = false;
+
+  Global &definedGlobal(uint16_t index, uint8_t *ip) {
+    Global &global = vm.globals[index];
+    if (!global.defined) {
+      fail(ip, "Undefined variable '" + std::string{global.name->chars} +
+                   "'.");
+    }
+    return global;
+  }
+  void runFrame();
+};
+
+// main() of a generated program.
+int aotMain(char const *src, AotFunction const *functions, size_t count);
+
+} // namespace lox
+
+#endif
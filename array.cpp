@@ -0,0 +1,277 @@
+#include "array.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "vm.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lox {
+
+namespace {
+
+// Each operation has a scalar form and, with SSE2, a form over two lanes.
+// The two forms agree lane for lane, so the vector loop and its scalar tail
+// compute the same thing.
+struct Add {
+  static double apply(double a, double b) { return a + b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+#endif
+};
+
+struct Subtract {
+  static double apply(double a, double b) { return a - b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+#endif
+};
+
+struct Multiply {
+  static double apply(double a, double b) { return a * b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+#endif
+};
+
+struct Divide {
+  static double apply(double a, double b) { return a / b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+#endif
+};
+
+// Comparisons turn the all-ones lane masks SSE2 produces into 1.0 or 0.0.
+struct Less {
+  static double apply(double a, double b) { return a < b ? 1.0 : 0.0; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) {
+    return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1.0));
+  }
+#endif
+};
+
+struct Greater {
+  static double apply(double a, double b) { return a > b ? 1.0 : 0.0; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) {
+    return _mm_and_pd(_mm_cmpgt_pd(a, b), _mm_set1_pd(1.0));
+  }
+#endif
+};
+
+struct Equal {
+  static double apply(double a, double b) { return a == b ? 1.0 : 0.0; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) {
+    return _mm_and_pd(_mm_cmpeq_pd(a, b), _mm_set1_pd(1.0));
+  }
+#endif
+};
+
+// Written to match minpd and maxpd, which return b when either is NaN.
+struct Min {
+  static double apply(double a, double b) { return a < b ? a : b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_min_pd(a, b); }
+#endif
+};
+
+struct Max {
+  static double apply(double a, double b) { return a > b ? a : b; }
+#if defined(__SSE2__)
+  static __m128d apply(__m128d a, __m128d b) { return _mm_max_pd(a, b); }
+#endif
+};
+
+// out[i] = Op(a[i], b[i]), or Op(a[i], *b) when broadcasting a number.
+template <typename Op, bool Broadcast>
+void map(double const *a, double const *b, double *out, size_t length) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  __m128d scalar = Broadcast ? _mm_set1_pd(*b) : _mm_setzero_pd();
+  for (; i + 4 <= length; i += 4) {
+    __m128d b0 = Broadcast ? scalar : _mm_loadu_pd(b + i);
+    __m128d b1 = Broadcast ? scalar : _mm_loadu_pd(b + i + 2);
+    _mm_storeu_pd(out + i, Op::apply(_mm_loadu_pd(a + i), b0));
+    _mm_storeu_pd(out + i + 2, Op::apply(_mm_loadu_pd(a + i + 2), b1));
+  }
+#endif
+  for (; i < length; i++) {
+    out[i] = Op::apply(a[i], Broadcast ? *b : b[i]);
+  }
+}
+
+// Folds the elements into initial with Op, using independent accumulators
+// so consecutive additions don't wait on each other. Sums therefore
+// associate differently from a left-to-right loop.
+template <typename Op>
+double reduce(double const *a, size_t length, double initial) {
+  size_t i = 0;
+  double result = initial;
+#if defined(__SSE2__)
+  if (length >= 4) {
+    __m128d acc0 = _mm_set1_pd(initial);
+    __m128d acc1 = acc0;
+    for (; i + 4 <= length; i += 4) {
+      acc0 = Op::apply(acc0, _mm_loadu_pd(a + i));
+      acc1 = Op::apply(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    acc0 = Op::apply(acc0, acc1);
+    result = Op::apply(_mm_cvtsd_f64(acc0),
+                       _mm_cvtsd_f64(_mm_unpackhi_pd(acc0, acc0)));
+  }
+#endif
+  for (; i < length; i++) {
+    result = Op::apply(result, a[i]);
+  }
+  return result;
+}
+
+double dotProduct(double const *a, double const *b, size_t length) {
+  size_t i = 0;
+  double result = 0;
+#if defined(__SSE2__)
+  __m128d acc0 = _mm_setzero_pd();
+  __m128d acc1 = _mm_setzero_pd();
+  for (; i + 4 <= length; i += 4) {
+    acc0 = _mm_add_pd(acc0,
+                      _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                       _mm_loadu_pd(b + i + 2)));
+  }
+  acc0 = _mm_add_pd(acc0, acc1);
+  result = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+#endif
+  for (; i < length; i++) {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+// Converts a script number used as a length or an index.
+size_t toSize(double number, char const *message) {
+  if (!(number >= 0) || number != std::floor(number) ||
+      number >= static_cast<double>(SIZE_MAX)) {
+    throw std::runtime_error(message);
+  }
+  return static_cast<size_t>(number);
+}
+
+size_t toIndex(ObjArray *array, double index) {
+  size_t position = toSize(index, "Array index must be a whole number.");
+  if (position >= array->length) {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  return position;
+}
+
+void checkLengths(ObjArray *a, ObjArray *b) {
+  if (a->length != b->length) {
+    throw std::runtime_error("Arrays must have the same length.");
+  }
+}
+
+ObjArray *makeArray(Heap &heap, double length, double fill) {
+  size_t size = toSize(length, "Array length must be a whole number.");
+  if (size > MAX_ARRAY_LENGTH) {
+    throw std::runtime_error("Array too large.");
+  }
+  return heap.allocate<ObjArray>(size, fill);
+}
+
+ObjArray *iota(Heap &heap, double length) {
+  ObjArray *array = makeArray(heap, length, 0);
+  for (size_t i = 0; i < array->length; i++) {
+    array->data[i] = static_cast<double>(i);
+  }
+  return array;
+}
+
+size_t length(ObjArray *array) { return array->length; }
+
+double get(ObjArray *array, double index) {
+  return array->data[toIndex(array, index)];
+}
+
+double set(ObjArray *array, double index, double value) {
+  if (array->isFrozen()) {
+    throw std::runtime_error("Can't modify a frozen array.");
+  }
+  return array->data[toIndex(array, index)] = value;
+}
+
+ObjArray *slice(Heap &heap, ObjArray *array, double start, double end) {
+  size_t from = toSize(start, "Slice bounds must be whole numbers.");
+  size_t to = toSize(end, "Slice bounds must be whole numbers.");
+  if (from > to || to > array->length) {
+    throw std::runtime_error("Slice bounds out of range.");
+  }
+  return heap.allocate<ObjArray>(array, from, to - from);
+}
+
+// Element-wise with another array of the same length, or with a number.
+template <typename Op>
+ObjArray *elementwise(Heap &heap, ObjArray *a, Value b) {
+  ObjArray *result = heap.allocate<ObjArray>(a->length, 0.0);
+  if (isNumber(b)) {
+    double number = asNumber(b);
+    map<Op, true>(a->data, &number, result->data, a->length);
+  } else if (isArray(b)) {
+    checkLengths(a, asArray(b));
+    map<Op, false>(a->data, asArray(b)->data, result->data, a->length);
+  } else {
+    throw std::runtime_error("Operand must be a number or an array.");
+  }
+  return result;
+}
+
+double sum(ObjArray *array) {
+  return reduce<Add>(array->data, array->length, 0);
+}
+
+double min(ObjArray *array) {
+  if (array->length == 0) {
+    throw std::runtime_error("Can't take the min of an empty array.");
+  }
+  return reduce<Min>(array->data, array->length, array->data[0]);
+}
+
+double max(ObjArray *array) {
+  if (array->length == 0) {
+    throw std::runtime_error("Can't take the max of an empty array.");
+  }
+  return reduce<Max>(array->data, array->length, array->data[0]);
+}
+
+double dot(ObjArray *a, ObjArray *b) {
+  checkLengths(a, b);
+  return dotProduct(a->data, b->data, a->length);
+}
+
+} // namespace
+
+void defineArrayNatives(VM &vm) {
+  vm.defineNative("array", makeArray);
+  vm.defineNative("arrayRange", iota);
+  vm.defineNative("arraySize", length);
+  vm.defineNative("arrayGet", get);
+  vm.defineNative("arraySet", set);
+  vm.defineNative("arraySlice", slice);
+  vm.defineNative("arrayAdd", elementwise<Add>);
+  vm.defineNative("arraySubtract", elementwise<Subtract>);
+  vm.defineNative("arrayMultiply", elementwise<Multiply>);
+  vm.defineNative("arrayDivide", elementwise<Divide>);
+  vm.defineNative("arrayLess", elementwise<Less>);
+  vm.defineNative("arrayGreater", elementwise<Greater>);
+  vm.defineNative("arrayEqual", elementwise<Equal>);
+  vm.defineNative("arraySum", sum);
+  vm.defineNative("arrayMin", min);
+  vm.defineNative("arrayMax", max);
+  vm.defineNative("arrayDot", dot);
+}
+
+} // namespace lox
@@ -0,0 +1,38 @@
+#ifndef cpplox_array_h
+#define cpplox_array_h
+
+#include <cstddef>
+#include <cstdint>
+
+#include "native.h"
+#include "object.h"
+
+namespace lox {
+class VM;
+
+template <> struct NativeType<ObjArray *> {
+  static ObjArray *unbox(ObjNative *native, Value value, size_t position) {
+    if (!isArray(value)) {
+      native->argumentError(position, "an array");
+    }
+    return asArray(value);
+  }
+  static Value box(Heap &, ObjArray *array) { return array; }
+};
+
+// Longer arrays can't be made, or saved in a snapshot.
+constexpr size_t MAX_ARRAY_LENGTH = UINT32_MAX;
+
+// Binds the array builtins, each but array(length, fill) named arrayVerb:
+// construction (array, arrayRange), element access (arraySize, arrayGet,
+// arraySet, arraySlice), element-wise arithmetic (arrayAdd, arraySubtract,
+// arrayMultiply, arrayDivide) and comparisons (arrayLess, arrayGreater,
+// arrayEqual) against another array or a number, and the reductions
+// arraySum, arrayMin, arrayMax and arrayDot. Comparisons produce masks of
+// ones and zeros. Every bulk operation is one native call over packed
+// doubles, vectorized with SSE2 where the target has it.
+void defineArrayNatives(VM &vm);
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,71 @@
+// Channel throughput between VMs on separate threads: several producer
+// scripts sending numbers to one consumer script, then one producer sending
+// a large frozen array that the consumer sums without copying it.
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../channel.h"
+#include "../vm.h"
+
+namespace {
+
+constexpr int producers = 3;
+constexpr int messages = 200000;
+
+double run(std::vector<std::string> const &scripts,
+           std::shared_ptr<lox::Channel> const &channel) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::string const &script : scripts) {
+    threads.emplace_back([&script, &channel] {
+      lox::VM vm;
+      vm.defineChannel("jobs", channel);
+      vm.interpret(script);
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main() {
+  std::string count = std::to_string(messages);
+  std::vector<std::string> scripts;
+  scripts.push_back("var total = 0;\n"
+                    "for (var i = 0; i < " +
+                    std::to_string(producers * messages) +
+                    "; i = i + 1) total = total + channelReceive(jobs);\n"
+                    "print total;\n");
+  for (int i = 0; i < producers; i++) {
+    scripts.push_back("for (var i = 0; i < " + count +
+                      "; i = i + 1) channelSend(jobs, i);\n");
+  }
+  double seconds = run(scripts, std::make_shared<lox::Channel>(1024));
+  std::printf("%d producers x %d numbers: %.2f Mmessages/s\n", producers,
+              messages, producers * messages / seconds / 1e6);
+
+  constexpr int arrays = 1000;
+  constexpr int length = 1000000;
+  scripts = {
+      "var total = 0;\n"
+      "for (var i = 0; i < " +
+          std::to_string(arrays) +
+          "; i = i + 1) total = total + arraySum(channelReceive(jobs));\n"
+          "print total;\n",
+      "var a = arrayFreeze(arrayRange(" + std::to_string(length) +
+          "));\n"
+          "for (var i = 0; i < " +
+          std::to_string(arrays) + "; i = i + 1) channelSend(jobs, a);\n",
+  };
+  seconds = run(scripts, std::make_shared<lox::Channel>(16));
+  std::printf("%d frozen arrays of %d numbers: %.1f GB/s summed\n", arrays,
+              length, arrays * (length * sizeof(double)) / seconds / 1e9);
+}
@@ -0,0 +1,228 @@
+// The map builtin's table against std::unordered_map holding the same
+// values: inserting integer keys, looking them up (hits and misses),
+// looking up interned strings, iterating, and lookups after heavy removal.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../object.h"
+#include "../table.h"
+
+namespace {
+
+constexpr int64_t keys = 1000000;
+constexpr int rounds = 5;
+
+struct ValueHash {
+  size_t operator()(lox::Value const &value) const {
+    if (auto integer = std::get_if<int64_t>(&value)) {
+      return std::hash<int64_t>{}(*integer);
+    }
+    if (auto object = std::get_if<lox::Object *>(&value)) {
+      return std::hash<lox::Object *>{}(*object);
+    }
+    if (auto number = std::get_if<double>(&value)) {
+      return std::hash<double>{}(*number);
+    }
+    if (auto boolean = std::get_if<bool>(&value)) {
+      return std::hash<bool>{}(*boolean);
+    }
+    return 0;
+  }
+};
+
+struct ValueEqual {
+  bool operator()(lox::Value const &a, lox::Value const &b) const {
+    if (a.index() != b.index()) {
+      return false;
+    }
+    if (auto integer = std::get_if<int64_t>(&a)) {
+      return *integer == std::get<int64_t>(b);
+    }
+    if (auto object = std::get_if<lox::Object *>(&a)) {
+      return *object == std::get<lox::Object *>(b);
+    }
+    if (auto number = std::get_if<double>(&a)) {
+      return *number == std::get<double>(b);
+    }
+    if (auto boolean = std::get_if<bool>(&a)) {
+      return *boolean == std::get<bool>(b);
+    }
+    return true;
+  }
+};
+
+using StdMap = std::unordered_map<lox::Value, lox::Value, ValueHash, ValueEqual>;
+
+// The best of several runs, in nanoseconds per operation.
+double time(int64_t operations, std::function<void()> const &body) {
+  double best = 0;
+  for (int i = 0; i < rounds; i++) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (i == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best * 1e9 / static_cast<double>(operations);
+}
+
+void report(char const *name, double table, double standard) {
+  std::printf("%-22s %7.1f ns  %7.1f ns  %5.2fx\n", name, table, standard,
+              standard / table);
+}
+
+// Spreads consecutive integers out so the keys aren't dense.
+int64_t scramble(int64_t i) { return (i * 2654435761) % (keys * 4); }
+
+// Visits the keys in another order than they went in, so neither table
+// finds them laid out in memory in lookup order.
+int64_t shuffled(int64_t i) { return scramble(i * 7919 % keys); }
+
+// Keeps the optimizer from dropping lookups whose results go unused.
+volatile double sink;
+
+} // namespace
+
+int main() {
+  std::printf("%-22s %10s  %10s  %6s\n", "", "table", "unordered", "speedup");
+
+  report(
+      "insert integers",
+      time(keys,
+           [] {
+             lox::Table table;
+             for (int64_t i = 0; i < keys; i++) {
+               table.set(scramble(i), i);
+             }
+           }),
+      time(keys, [] {
+        StdMap map;
+        for (int64_t i = 0; i < keys; i++) {
+          map.emplace(scramble(i), i);
+        }
+      }));
+
+  lox::Table table;
+  StdMap map;
+  for (int64_t i = 0; i < keys; i++) {
+    table.set(scramble(i), i);
+    map.emplace(scramble(i), i);
+  }
+
+  report(
+      "lookup integer hits",
+      time(keys,
+           [&] {
+             int64_t found = 0;
+             for (int64_t i = 0; i < keys; i++) {
+               found += table.find(shuffled(i)) != nullptr;
+             }
+             sink = static_cast<double>(found);
+           }),
+      time(keys, [&] {
+        int64_t found = 0;
+        for (int64_t i = 0; i < keys; i++) {
+          found += map.find(shuffled(i)) != map.end();
+        }
+        sink = static_cast<double>(found);
+      }));
+
+  report(
+      "lookup integer misses",
+      time(keys,
+           [&] {
+             int64_t found = 0;
+             for (int64_t i = 0; i < keys; i++) {
+               found += table.find(keys * 4 + i) != nullptr;
+             }
+             sink = static_cast<double>(found);
+           }),
+      time(keys, [&] {
+        int64_t found = 0;
+        for (int64_t i = 0; i < keys; i++) {
+          found += map.find(keys * 4 + i) != map.end();
+        }
+        sink = static_cast<double>(found);
+      }));
+
+  report(
+      "iterate",
+      time(keys,
+           [&] {
+             double total = 0;
+             for (size_t i = table.next(0); i != table.capacity();
+                  i = table.next(i + 1)) {
+               total += static_cast<double>(
+                   std::get<int64_t>(table.valueAt(i)));
+             }
+             sink = total;
+           }),
+      time(keys, [&] {
+        double total = 0;
+        for (auto const &[key, value] : map) {
+          total += static_cast<double>(std::get<int64_t>(value));
+        }
+        sink = total;
+      }));
+
+  for (int64_t i = 0; i < keys; i += 4) {
+    table.remove(scramble(i));
+    map.erase(scramble(i));
+  }
+  report(
+      "lookup after removals",
+      time(keys,
+           [&] {
+             int64_t found = 0;
+             for (int64_t i = 0; i < keys; i++) {
+               found += table.find(shuffled(i)) != nullptr;
+             }
+             sink = static_cast<double>(found);
+           }),
+      time(keys, [&] {
+        int64_t found = 0;
+        for (int64_t i = 0; i < keys; i++) {
+          found += map.find(shuffled(i)) != map.end();
+        }
+        sink = static_cast<double>(found);
+      }));
+
+  // Rule engines look facts up by name: a few thousand interned strings.
+  constexpr int64_t names = 4096;
+  lox::Heap heap;
+  std::vector<lox::Value> strings;
+  lox::Table byName;
+  StdMap stdByName;
+  for (int64_t i = 0; i < names; i++) {
+    strings.push_back(heap.intern("fact" + std::to_string(i)));
+    byName.set(strings.back(), i);
+    stdByName.emplace(strings.back(), i);
+  }
+  report(
+      "lookup strings",
+      time(keys,
+           [&] {
+             int64_t total = 0;
+             for (int64_t i = 0; i < keys; i++) {
+               total += std::get<int64_t>(
+                   *byName.find(strings[static_cast<size_t>(i % names)]));
+             }
+             sink = static_cast<double>(total);
+           }),
+      time(keys, [&] {
+        int64_t total = 0;
+        for (int64_t i = 0; i < keys; i++) {
+          total += std::get<int64_t>(
+              stdByName.find(strings[static_cast<size_t>(i % names)])
+                  ->second);
+        }
+        sink = static_cast<double>(total);
+      }));
+}
@@ -0,0 +1,88 @@
+// Scanner throughput on identifier-heavy input: generated declarations and
+// calls where most tokens are identifiers or keywords.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "../keywords.h"
+#include "../scanner.h"
+
+namespace {
+
+char const *const words[] = {
+    "value", "index", "count", "and",     "or",     "this",
+    "total", "fun",   "node",  "nil",     "result", "while",
+    "for",   "rule",  "true",  "matches", "return", "classify",
+};
+constexpr size_t wordCount = sizeof(words) / sizeof(words[0]);
+
+std::string makeSource(size_t lines) {
+  std::string src;
+  for (size_t i = 0; i < lines; i++) {
+    char const *a = words[i % wordCount];
+    char const *b = words[(i * 7 + 3) % wordCount];
+    char const *c = words[(i * 13 + 5) % wordCount];
+    src += "var ";
+    src += a;
+    src += "_" + std::to_string(i % 97);
+    src += " = ";
+    src += b;
+    src += ".";
+    src += c;
+    src += "(";
+    src += a;
+    src += ", ";
+    src += c;
+    src += ");\n";
+  }
+  return src;
+}
+
+} // namespace
+
+int main() {
+  constexpr int rounds = 20;
+  std::string src = makeSource(100000);
+
+  size_t tokens = 0;
+  size_t identifiers = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    lox::Scanner scanner{src};
+    for (;;) {
+      lox::Token token = scanner.scanToken();
+      tokens++;
+      identifiers += token.type == lox::TOKEN_IDENTIFIER;
+      if (token.type == lox::TOKEN_EOF) {
+        break;
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("%zu bytes x %d rounds, %zu tokens (%zu identifiers)\n",
+              src.size(), rounds, tokens, identifiers);
+  std::printf("%.1f MB/s, %.1f Mtokens/s\n",
+              src.size() * rounds / seconds / 1e6, tokens / seconds / 1e6);
+
+  constexpr size_t lookups = 50000000;
+  size_t lengths[wordCount];
+  for (size_t i = 0; i < wordCount; i++) {
+    lengths[i] = std::strlen(words[i]);
+  }
+  size_t keywords = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < lookups; i++) {
+    size_t word = i % wordCount;
+    keywords += lox::keywords::classify(words[word], lengths[word]) !=
+                lox::TOKEN_IDENTIFIER;
+  }
+  end = std::chrono::steady_clock::now();
+
+  seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("keyword classification: %.2f ns/identifier (%zu keywords)\n",
+              seconds * 1e9 / lookups, keywords);
+  return 0;
+}
@@ -0,0 +1,264 @@
+#include "channel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#include "array.h"
+#include "vm.h"
+
+namespace lox {
+
+namespace {
+
+constexpr size_t MAX_CAPACITY = size_t{1} << 20;
+
+// Waits out a full or empty channel: a short spin for a peer that is
+// about to catch up, then yields so a descheduled peer can run.
+class Backoff {
+public:
+  void wait() {
+    if (spins < 64) {
+      spins++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  int spins = 0;
+};
+
+} // namespace
+
+Channel::Channel(size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size *= 2;
+  }
+  this->slots = std::make_unique<Slot[]>(size);
+  this->mask = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    this->slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool Channel::trySend(Message &message) {
+  size_t position = tail.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot &slot = this->slots[position & this->mask];
+    size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    auto lag = static_cast<std::ptrdiff_t>(sequence - position);
+    if (lag == 0) {
+      // Free for this position; take it unless another sender got there.
+      if (tail.compare_exchange_weak(position, position + 1,
+                                     std::memory_order_relaxed)) {
+        slot.message = std::move(message);
+        slot.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (lag < 0) {
+      // Still holds the message from one lap ago.
+      return false;
+    } else {
+      position = tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool Channel::tryReceive(Message &message) {
+  Slot &slot = this->slots[this->head & this->mask];
+  if (slot.sequence.load(std::memory_order_acquire) != this->head + 1) {
+    return false;
+  }
+  message = std::move(slot.message);
+  // Drops any buffer the slot still shares.
+  slot.message = Nil{};
+  slot.sequence.store(this->head + this->mask + 1, std::memory_order_release);
+  this->head++;
+  return true;
+}
+
+void Channel::send(Message message) {
+  for (Backoff backoff;; backoff.wait()) {
+    if (isClosed()) {
+      throw std::runtime_error("Can't send on a closed channel.");
+    }
+    if (trySend(message)) {
+      return;
+    }
+    if (alone()) {
+      throw std::runtime_error(
+          "Can't wait to send on a channel nothing else holds.");
+    }
+  }
+}
+
+bool Channel::receive(Message &message) {
+  for (Backoff backoff;; backoff.wait()) {
+    // Messages sent before the close are still delivered, as are those
+    // sent by a peer that has since gone.
+    bool wasClosed = isClosed();
+    bool wasAlone = alone();
+    if (tryReceive(message)) {
+      return true;
+    }
+    if (wasClosed) {
+      return false;
+    }
+    if (wasAlone) {
+      throw std::runtime_error(
+          "Can't wait to receive on a channel nothing else holds.");
+    }
+  }
+}
+
+bool Channel::alone() const {
+  bool alone = weak_from_this().use_count() == 1;
+  // Pairs with the release in the last peer's decrement, so everything it
+  // sent is visible to the next tryReceive.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return alone;
+}
+
+bool Channel::claim(void const *receiver) {
+  void const *expected = nullptr;
+  return this->receiver.compare_exchange_strong(expected, receiver,
+                                                std::memory_order_relaxed) ||
+         expected == receiver;
+}
+
+namespace {
+
+Message toMessage(Value value) {
+  if (isNumber(value)) {
+    return asNumber(value);
+  }
+  if (bool const *boolean = std::get_if<bool>(&value)) {
+    return *boolean;
+  }
+  if (std::holds_alternative<Nil>(value)) {
+    return Nil{};
+  }
+  if (isString(value)) {
+    return std::string{asString(value)->chars};
+  }
+  if (isArray(value)) {
+    ObjArray *array = asArray(value);
+    if (!array->isFrozen()) {
+      throw std::runtime_error("Only frozen arrays can be sent.");
+    }
+    ObjArray *owner = array->base != nullptr ? array->base : array;
+    return FrozenArray{owner->frozen, array->data, array->length};
+  }
+  if (isChannel(value)) {
+    return asChannel(value)->channel;
+  }
+  throw std::runtime_error("Only numbers, booleans, nil, strings, frozen "
+                           "arrays and channels can be sent.");
+}
+
+Value toValue(Heap &heap, Message &message) {
+  struct Visitor {
+    Heap &heap;
+    Value operator()(Nil) { return Nil{}; }
+    Value operator()(bool boolean) { return boolean; }
+    Value operator()(double number) { return number; }
+    Value operator()(std::string &string) { return heap.intern(string); }
+    Value operator()(FrozenArray &array) {
+      return heap.allocate<ObjArray>(std::move(array.buffer), array.data,
+                                     array.length);
+    }
+    Value operator()(std::shared_ptr<Channel> &channel) {
+      return heap.allocate<ObjChannel>(std::move(channel));
+    }
+  };
+  return std::visit(Visitor{heap}, message);
+}
+
+ObjChannel *makeChannel(Heap &heap, double capacity) {
+  if (!(capacity >= 1) || capacity != std::floor(capacity)) {
+    throw std::runtime_error(
+        "Channel capacity must be a positive whole number.");
+  }
+  if (capacity > static_cast<double>(MAX_CAPACITY)) {
+    throw std::runtime_error("Channel capacity too large.");
+  }
+  return heap.allocate<ObjChannel>(
+      std::make_shared<Channel>(static_cast<size_t>(capacity)));
+}
+
+void send(VM &vm, ObjChannel *channel, Value value) {
+  Message message = toMessage(value);
+  Channel &queue = *channel->channel;
+  if (queue.isClosed() || !queue.trySend(message)) {
+    // Whatever the script printed so far shouldn't wait along with it.
+    vm.output().flush();
+    queue.send(std::move(message));
+  }
+}
+
+bool trySend(ObjChannel *channel, Value value) {
+  Message message = toMessage(value);
+  if (channel->channel->isClosed()) {
+    throw std::runtime_error("Can't send on a closed channel.");
+  }
+  return channel->channel->trySend(message);
+}
+
+// Each VM has its own heap, which serves as the VM's identity here.
+void claim(Heap &heap, ObjChannel *channel) {
+  if (!channel->channel->claim(&heap)) {
+    throw std::runtime_error("Only one VM can receive from a channel.");
+  }
+}
+
+Value receive(VM &vm, ObjChannel *channel) {
+  Heap &heap = vm.objects();
+  claim(heap, channel);
+  Message message;
+  Channel &queue = *channel->channel;
+  if (!queue.tryReceive(message)) {
+    vm.output().flush();
+    if (!queue.receive(message)) {
+      return Nil{};
+    }
+  }
+  return toValue(heap, message);
+}
+
+Value tryReceive(Heap &heap, ObjChannel *channel) {
+  claim(heap, channel);
+  Message message;
+  if (!channel->channel->tryReceive(message)) {
+    return Nil{};
+  }
+  return toValue(heap, message);
+}
+
+void close(ObjChannel *channel) { channel->channel->close(); }
+
+ObjArray *freeze(Heap &heap, ObjArray *array) {
+  if (array->isFrozen()) {
+    return array;
+  }
+  std::shared_ptr<double[]> buffer{new double[array->length]};
+  std::copy(array->data, array->data + array->length, buffer.get());
+  double *data = buffer.get();
+  return heap.allocate<ObjArray>(std::move(buffer), data, array->length);
+}
+
+} // namespace
+
+void defineChannelNatives(VM &vm) {
+  vm.defineNative("channel", makeChannel);
+  vm.defineNative("channelSend", send);
+  vm.defineNative("channelTrySend", trySend);
+  vm.defineNative("channelReceive", receive);
+  vm.defineNative("channelTryReceive", tryReceive);
+  vm.defineNative("channelClose", close);
+  vm.defineNative("arrayFreeze", freeze);
+}
+
+} // namespace lox
@@ -0,0 +1,105 @@
+#ifndef cpplox_channel_h
+#define cpplox_channel_h
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <variant>
+
+#include "native.h"
+#include "object.h"
+#include "value.h"
+
+namespace lox {
+class VM;
+
+// The elements of a frozen array, or of a slice of one, in transit.
+struct FrozenArray {
+  std::shared_ptr<double[]> buffer;
+  double *data;
+  size_t length;
+};
+
+// A value on its way between VMs, holding nothing from either heap. Frozen
+// arrays and channels travel by reference. Strings are copied, since each
+// VM interns its own.
+using Message = std::variant<Nil, bool, double, std::string, FrozenArray,
+                             std::shared_ptr<Channel>>;
+
+// A bounded, lock-free queue carrying messages from any number of sending
+// VMs to one receiving VM, each possibly on its own thread. Every slot
+// carries a sequence number that says whose turn it is: senders claim a
+// position by bumping the tail and publish by advancing the slot's sequence,
+// and the receiver hands the slot back the same way. Share one between VMs
+// with VM::defineChannel, or send it over another channel.
+class Channel : public std::enable_shared_from_this<Channel> {
+public:
+  // Rounds capacity up to a power of two, and at least two.
+  explicit Channel(size_t capacity);
+  Channel(Channel const &) = delete;
+  Channel &operator=(Channel const &) = delete;
+
+  // Moves message into the channel unless it is full.
+  bool trySend(Message &message);
+  // Moves the oldest message out unless the channel is empty. Only the
+  // receiver may call this.
+  bool tryReceive(Message &message);
+  // Blocking forms, which spin and then yield the thread while the channel
+  // is full or empty. send throws once the channel is closed; receive
+  // returns false once it is closed and drained. Both throw rather than
+  // wait for a peer that can't exist: one whose channel has no owner but
+  // the caller.
+  void send(Message message);
+  bool receive(Message &message);
+
+  void close() { closed.store(true, std::memory_order_release); }
+  bool isClosed() const { return closed.load(std::memory_order_acquire); }
+  size_t capacity() const { return mask + 1; }
+
+  // Makes receiver, an opaque identity, the only one allowed to receive.
+  // Returns false if another receiver already has.
+  bool claim(void const *receiver);
+
+private:
+  // Whether the caller's reference is the only one, so nothing else can
+  // send or receive.
+  bool alone() const;
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Message message;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  std::atomic<void const *> receiver{nullptr};
+  std::atomic<bool> closed{false};
+  // Senders and the receiver each get a cache line to themselves.
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) size_t head = 0;
+};
+
+template <> struct NativeType<ObjChannel *> {
+  static ObjChannel *unbox(ObjNative *native, Value value, size_t position) {
+    if (!isChannel(value)) {
+      native->argumentError(position, "a channel");
+    }
+    return asChannel(value);
+  }
+  static Value box(Heap &, ObjChannel *channel) { return channel; }
+};
+
+// Binds channel(capacity), channelSend(channel, value),
+// channelReceive(channel) and channelClose(channel), and arrayFreeze(array),
+// which returns a frozen copy of an array that can be sent without copying
+// its elements again. Numbers, booleans, nil, strings, frozen arrays and
+// channels can be sent. A VM that sends to a full channel or receives from
+// an empty one flushes its output and waits; channelTrySend(channel, value)
+// returns false instead, and channelTryReceive(channel) returns nil, which
+// is also what a nil message looks like.
+void defineChannelNatives(VM &vm);
+
+} // namespace lox
+
+#endif
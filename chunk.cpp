@@ -22,7 +22,7 @@ size_t Chunk::getLine(size_t instructionIdx) {
   for (size_t i = 0; i < this->lines.size(); i += 2) {
     length += this->lines[i];
 
-    if (length < instructionIdx) {
+    if (instructionIdx >= length) {
       continue;
     }
 
@@ -38,4 +38,46 @@ uint64_t Chunk::addConstant(Value value) {
   return this->constants.size() - 1;
 }
 
+uint16_t Chunk::addCache() {
+  this->caches.emplace_back();
+
+  return static_cast<uint16_t>(this->caches.size() - 1);
+}
+
+uint16_t Chunk::addLoop() {
+  this->loops.emplace_back();
+
+  return static_cast<uint16_t>(this->loops.size() - 1);
+}
+
+size_t instructionLength(uint8_t opcode) {
+  switch (opcode) {
+  case OP_CONSTANT:
+  case OP_POPN:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_CALL:
+  case OP_TAIL_CALL:
+  case OP_CLASS:
+  case OP_METHOD:
+    return 2;
+  case OP_DEFINE_GLOBAL:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_LOCAL_LONG:
+  case OP_SET_LOCAL_LONG:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+    return 3;
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+    return 4;
+  case OP_LOOP:
+  case OP_INVOKE:
+    return 5;
+  default:
+    return 1;
+  }
+}
+
 } // namespace lox
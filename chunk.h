@@ -1,12 +1,17 @@
 #ifndef clox_chunk_h
 #define clox_chunk_h
 
+#include <array>
+#include <memory_resource>
 #include <vector>
 
 #include "common.h"
 #include "value.h"
 
 namespace lox {
+class ObjFunction;
+class Shape;
+
 enum OpCode {
   OP_CONSTANT,
   OP_NIL,
@@ -21,24 +26,175 @@ enum OpCode {
   OP_DIVIDE,
   OP_NOT,
   OP_NEGATE,
+  OP_PRINT,
+  OP_POP,
+  OP_POPN,
+  OP_DEFINE_GLOBAL,
+  OP_GET_GLOBAL,
+  OP_SET_GLOBAL,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  OP_GET_LOCAL_LONG,
+  OP_SET_LOCAL_LONG,
+  OP_JUMP,
+  OP_JUMP_IF_FALSE,
+  OP_LOOP,
+  OP_CALL,
+  OP_TAIL_CALL,
+  OP_CLASS,
+  OP_METHOD,
+  OP_GET_PROPERTY,
+  OP_SET_PROPERTY,
+  OP_INVOKE,
   OP_RETURN,
 };
 
+// One receiver shape seen at a property access site and what it resolved to.
+struct CacheEntry {
+  Shape *shape = nullptr;
+  uint32_t slot = 0;
+  // Set when a store added the field: the shape the instance moves to.
+  Shape *transition = nullptr;
+  // Set when the name resolved to a method of the receiver's class.
+  ObjFunction *method = nullptr;
+};
+
+// Polymorphic inline cache for a single OP_GET_PROPERTY, OP_SET_PROPERTY or
+// OP_INVOKE. Sites that see more shapes than fit go megamorphic and stop
+// caching.
+struct InlineCache {
+  static constexpr size_t SIZE = 4;
+
+  std::array<CacheEntry, SIZE> entries;
+  uint8_t count = 0;
+
+  CacheEntry const *find(Shape const *shape) const {
+    for (uint8_t i = 0; i < count; i++) {
+      if (entries[i].shape == shape) {
+        return &entries[i];
+      }
+    }
+    return nullptr;
+  }
+
+  void add(CacheEntry entry) {
+    if (count < SIZE) {
+      entries[count++] = entry;
+    }
+  }
+};
+
+// Where a trace instruction reads a value from. Loads of locals and
+// literals are folded into the instruction that consumes them instead of
+// going through the value stack.
+enum class OperandKind : uint8_t {
+  Stack,
+  Local,
+  Constant,
+  Nil,
+  True,
+  False,
+};
+
+struct Operand {
+  OperandKind kind = OperandKind::Stack;
+  uint16_t index = 0;
+};
+
+enum class TraceOp : uint8_t {
+  PUSH,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  LESS,
+  GREATER,
+  EQUAL,
+  NOT,
+  NEGATE,
+  GUARD,
+  GET_GLOBAL,
+  SET_GLOBAL,
+  SET_LOCAL,
+  POPN,
+  PRINT,
+  LOOP,
+};
+
+// Comparisons and guards either push their result or check it against the
+// direction the recorded iteration took.
+enum class TraceBranch : uint8_t {
+  None,
+  ExpectTrue,
+  ExpectFalse,
+};
+
+// One type-specialized step of a compiled loop trace. Arithmetic assumes
+// numbers and branches assume the recorded direction; when an assumption
+// fails the trace side-exits to the bytecode at `exit`, where the value
+// stack matches what the interpreter expects.
+struct TraceInstruction {
+  TraceOp op = TraceOp::PUSH;
+  TraceBranch branch = TraceBranch::None;
+  // Set when the instruction also pops the value it stored or tested.
+  bool pop = false;
+  Operand a;
+  Operand b;
+  // Local slot, global index or pop count.
+  uint16_t index = 0;
+  uint32_t exit = 0;
+};
+
+// Per-OP_LOOP state: how often the back edge ran, and the trace compiled
+// for the loop once it got hot.
+struct LoopSite {
+  static constexpr uint16_t HOT = 64;
+  static constexpr uint8_t MAX_FAILURES = 4;
+
+  // Back edges taken while cold, or early exits from the trace once hot.
+  uint16_t hits = 0;
+  // Recordings that were abandoned or traces that were dropped; past
+  // MAX_FAILURES the loop stays interpreted.
+  uint8_t failures = 0;
+  // Bytecode instructions one trip around the trace stands for.
+  uint32_t instructionCount = 0;
+  uint32_t traceStart = 0;
+  uint32_t traceLength = 0;
+};
+
 // using Chunk = std::vector<uint8_t>;
 
 class Chunk {
 public:
-  std::vector<uint8_t> codes;
-  std::vector<size_t> lines;
+  explicit Chunk(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : codes{memory}, lines{memory}, constants{memory}, caches{memory},
+        loops{memory}, traces{memory} {}
+
+  std::pmr::vector<uint8_t> codes;
+  std::pmr::vector<size_t> lines;
   ValueArray constants;
+  std::pmr::vector<InlineCache> caches;
+  std::pmr::vector<LoopSite> loops;
+  // Compiled traces of every loop in the chunk, back to back.
+  std::pmr::vector<TraceInstruction> traces;
+  // Filled in by verifyChunk(): the deepest the value stack gets, counted
+  // from the frame's slot zero.
+  size_t maxStack = 0;
+  bool verified = false;
 
   void write(uint8_t byte, size_t line);
   void init();
   size_t getLine(size_t instructionIdx);
 
   uint64_t addConstant(Value);
+  uint16_t addCache();
+  uint16_t addLoop();
 };
 
+// Size in bytes of an instruction with this opcode, operands included.
+size_t instructionLength(uint8_t opcode);
+
 } // namespace lox
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+// Thin client for cpplox --serve. Sends a script to the server along with
+// this process's standard output and error, which the script writes to
+// directly, and exits with the script's status.
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+static void usage() {
+  fprintf(stderr, "Usage: cpplox-client socket (path | -)\n"
+                  "  Runs the script at path, or read from standard input, "
+                  "on the server.\n");
+  exit(64);
+}
+
+static int fail(char const *what) {
+  fprintf(stderr, "%s: %s\n", what, std::strerror(errno));
+  return 74;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    usage();
+  }
+
+  lox::RequestHeader header{lox::PROTOCOL_VERSION, lox::RequestKind::Path, 0};
+  std::string payload;
+  if (std::strcmp(argv[2], "-") == 0) {
+    header.kind = lox::RequestKind::Source;
+    payload.assign(std::istreambuf_iterator<char>{std::cin},
+                   std::istreambuf_iterator<char>{});
+  } else {
+    // The server has its own working directory.
+    char resolved[PATH_MAX];
+    if (realpath(argv[2], resolved) == nullptr) {
+      fprintf(stderr, "Unable to open file\n");
+      return 74;
+    }
+    payload = resolved;
+  }
+  if (payload.size() > lox::MAX_REQUEST_LENGTH) {
+    fprintf(stderr, "Script too large.\n");
+    return 74;
+  }
+  header.length = static_cast<uint32_t>(payload.size());
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(argv[1]) >= sizeof(address.sun_path)) {
+    usage();
+  }
+  std::strcpy(address.sun_path, argv[1]);
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0 || connect(server, reinterpret_cast<sockaddr *>(&address),
+                            sizeof(address)) != 0) {
+    return fail(argv[1]);
+  }
+
+  int fds[] = {STDOUT_FILENO, STDERR_FILENO};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+  iovec io{&header, sizeof(header)};
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+  cmsghdr *part = CMSG_FIRSTHDR(&message);
+  part->cmsg_level = SOL_SOCKET;
+  part->cmsg_type = SCM_RIGHTS;
+  part->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(part), fds, sizeof(fds));
+  if (sendmsg(server, &message, MSG_NOSIGNAL) != sizeof(header)) {
+    return fail("Can't send the request");
+  }
+  for (size_t sent = 0; sent < payload.size();) {
+    ssize_t count = send(server, payload.data() + sent, payload.size() - sent,
+                         MSG_NOSIGNAL);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return fail("Can't send the request");
+    }
+    sent += static_cast<size_t>(count);
+  }
+
+  int32_t status;
+  ssize_t received;
+  do {
+    received = recv(server, &status, sizeof(status), MSG_WAITALL);
+  } while (received < 0 && errno == EINTR);
+  if (received != sizeof(status)) {
+    fprintf(stderr, "The server closed the connection.\n");
+    return 74;
+  }
+  return status;
+}
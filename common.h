@@ -4,8 +4,8 @@
 #include <cstddef>
 #include <cstdint>
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+// DEBUG_TRACE_EXECUTION and DEBUG_PRINT_CODE come from the build; see the
+// trace_execution and print_code options.
 
 namespace lox {
 template <typename T> T nextEnum(T enumMember) {
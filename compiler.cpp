@@ -2,36 +2,138 @@
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "number.h"
+#include "optimizer.h"
 #include "scanner.h"
 #include "value.h"
+#include <charconv>
 #include <cstdint>
 #include <cstdio>
+#include <limits>
 #include <memory>
 #include <string>
+#include <system_error>
 
 namespace lox {
 
-bool Parser::compile(std::string const &src, Chunk &chunk) {
-  scanner = std::make_unique<Scanner>(Scanner{src});
-  compilingChunk = &chunk;
+namespace {
+// Parses a number literal (digits with an optional fraction) straight from
+// the source text. from_chars is locale independent, rounds correctly and
+// reports range errors instead of throwing; a literal that overflows becomes
+// infinity and one that underflows becomes zero. Literals without a
+// fraction that fit the integer range become integers; see number.h.
+Value parseNumber(std::string_view text) {
+  if (text.find('.') == std::string_view::npos) {
+    int64_t integer = 0;
+    auto [end, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), integer);
+    if (ec == std::errc{} && fitsInteger(integer)) {
+      return integer;
+    }
+  }
+
+  double value = 0;
+  auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                   value, std::chars_format::fixed);
+  if (ec == std::errc::result_out_of_range) {
+    bool hasIntegerPart = text.find_first_not_of("0.") < text.find('.');
+    return hasIntegerPart ? std::numeric_limits<double>::infinity() : 0.0;
+  }
+
+  return value;
+}
+} // namespace
+
+ObjFunction *Parser::compile(std::string const &src) {
+  scanner = std::make_unique<Scanner>(src);
+  if (lazy) {
+    source = std::make_shared<std::string const>(src);
+  }
+  Compiler script{};
+  initCompiler(script, FunctionType::Script);
 
   advance();
-  expression();
-  consume(TOKEN_EOF, "Expect end of expression.");
-  endCompiler();
+  while (!match(TOKEN_EOF)) {
+    declaration();
+  }
+  ObjFunction *function = endCompiler();
 
-  return !hadError;
+  return hadError ? nullptr : function;
 }
 
-void Parser::endCompiler() { emitReturn(); }
+ObjFunction *Parser::compileBody(LazyBody const &body, std::string_view name) {
+  source = body.source;
+  sourceOffset = body.start;
+  scanner = std::make_unique<Scanner>(
+      std::string_view{*source}.substr(body.start, body.end - body.start),
+      body.line);
+  ClassCompiler classCompiler{};
+  if (body.inClass) {
+    currentClass = &classCompiler;
+  }
+
+  // initCompiler() takes the function's name from the token before '('.
+  advance();
+  previous = Token{TOKEN_IDENTIFIER, body.line, name};
+  Compiler compiler{};
+  initCompiler(compiler, body.type);
+  functionBody(compiler);
+  ObjFunction *function = endCompiler();
+  consume(TOKEN_EOF, "Expect end of function body.");
+
+  return hadError ? nullptr : function;
+}
+
+void Parser::initCompiler(Compiler &compiler, FunctionType type) {
+  compiler.enclosing = this->compiler;
+  compiler.type = type;
+  if (skipping > 0) {
+    scratch.push_back(
+        std::make_unique<ObjFunction>(std::pmr::get_default_resource()));
+    compiler.function = scratch.back().get();
+  } else {
+    compiler.function = heap.allocate<ObjFunction>();
+  }
+  this->compiler = &compiler;
+
+  if (type != FunctionType::Script) {
+    compiler.function->name = previous.str;
+  }
+
+  // Slot zero holds the callee itself, or the receiver in methods.
+  if (type == FunctionType::Method || type == FunctionType::Initializer) {
+    compiler.locals.push_back(Local{"this", 0});
+  } else {
+    compiler.locals.push_back(Local{"", 0});
+  }
+}
+
+ObjFunction *Parser::endCompiler() {
+  emitReturn();
+  ObjFunction *function = compiler->function;
+  if (!hadError && skipping == 0) {
+    optimizeJumps(currentChunk());
+  }
 
-void Parser::emitReturn() {
-  emitByte(OP_RETURN);
 #ifdef DEBUG_PRINT_CODE
-  if (!hadError) {
-    disassembleChunk(currentChunk(), "code");
+  if (!hadError && skipping == 0) {
+    disassembleChunk(out, currentChunk(),
+                     function->name.empty() ? "<script>"
+                                            : std::string{function->name});
   }
 #endif
+
+  compiler = compiler->enclosing;
+  return function;
+}
+
+void Parser::emitReturn() {
+  if (compiler->type == FunctionType::Initializer) {
+    emitBytes(OP_GET_LOCAL, 0);
+  } else {
+    emitByte(OP_NIL);
+  }
+  emitByte(OP_RETURN);
 }
 
 void Parser::advance() {
@@ -42,7 +144,7 @@ void Parser::advance() {
       break;
     }
 
-    errorAtCurrent(current.str);
+    errorAtCurrent(std::string{current.str});
   }
 }
 
@@ -55,6 +157,16 @@ void Parser::consume(TokenType type, std::string const &message) {
   errorAtCurrent(message);
 }
 
+bool Parser::check(TokenType type) { return current.type == type; }
+
+bool Parser::match(TokenType type) {
+  if (!check(type)) {
+    return false;
+  }
+  advance();
+  return true;
+}
+
 void Parser::errorAtCurrent(std::string message) { errorAt(current, message); }
 
 void Parser::error(std::string message) { errorAt(previous, message); }
@@ -71,7 +183,8 @@ void Parser::errorAt(Token const &token, std::string message) {
   } else if (token.type == TOKEN_ERROR) {
     // Nothing.
   } else {
-    fprintf(stderr, " at '%s'", token.str.c_str());
+    fprintf(stderr, " at '%.*s'", static_cast<int>(token.str.size()),
+            token.str.data());
   }
 
   fprintf(stderr, ": %s\n", message.c_str());
@@ -87,14 +200,524 @@ void Parser::emitBytes(uint8_t a, uint8_t b) {
   emitByte(b);
 }
 
-Chunk &Parser::currentChunk() { return *compilingChunk; }
+void Parser::emitShort(uint16_t value) {
+  emitBytes((value >> 8) & 0xff, value & 0xff);
+}
+
+void Parser::emitLocalOp(OpCode shortOp, OpCode longOp, int slot) {
+  if (slot <= UINT8_MAX) {
+    emitBytes(shortOp, slot);
+  } else {
+    emitByte(longOp);
+    emitShort(slot);
+  }
+}
+
+void Parser::emitPops(int count) {
+  while (count > 1) {
+    int n = count > UINT8_MAX ? UINT8_MAX : count;
+    emitBytes(OP_POPN, n);
+    count -= n;
+  }
+  if (count == 1) {
+    emitByte(OP_POP);
+  }
+}
+
+// Emits a forward jump with a placeholder distance and returns the offset
+// of the operand for patchJump().
+size_t Parser::emitJump(OpCode instruction) {
+  emitByte(instruction);
+  emitShort(0xffff);
+  return currentChunk().codes.size() - 2;
+}
+
+void Parser::patchJump(size_t offset) {
+  size_t jump = currentChunk().codes.size() - offset - 2;
+  if (jump > UINT16_MAX) {
+    error("Too much code to jump over.");
+  }
+
+  currentChunk().codes[offset] = (jump >> 8) & 0xff;
+  currentChunk().codes[offset + 1] = jump & 0xff;
+}
+
+// OP_LOOP's distance is measured from the end of the instruction, after the
+// operand naming the loop's counter and trace.
+void Parser::emitLoop(size_t loopStart) {
+  emitByte(OP_LOOP);
+
+  size_t distance = currentChunk().codes.size() - loopStart + 4;
+  if (distance > UINT16_MAX) {
+    error("Loop body too large.");
+  }
+  emitShort(distance);
+
+  if (currentChunk().loops.size() > UINT16_MAX) {
+    error("Too many loops in one chunk.");
+    return;
+  }
+  emitShort(currentChunk().addLoop());
+}
+
+Chunk &Parser::currentChunk() { return compiler->function->chunk; }
 
 // void Parser::writeChunk(Chunk &chunk, uint8_t byte, int line) {}
 
+void Parser::declaration() {
+  if (match(TOKEN_CLASS)) {
+    classDeclaration();
+  } else if (match(TOKEN_FUN)) {
+    funDeclaration();
+  } else if (match(TOKEN_VAR)) {
+    varDeclaration();
+  } else {
+    statement();
+  }
+
+  if (panicMode) {
+    synchronize();
+  }
+}
+
+void Parser::classDeclaration() {
+  consume(TOKEN_IDENTIFIER, "Expect class name.");
+  Token className = previous;
+  uint8_t nameConstant = identifierConstant(previous);
+  declareVariable();
+
+  emitBytes(OP_CLASS, nameConstant);
+  int global = compiler->scopeDepth > 0 ? 0 : resolveGlobal(className.str);
+  defineVariable(global);
+
+  ClassCompiler classCompiler{currentClass};
+  currentClass = &classCompiler;
+
+  namedVariable(className, false);
+  consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+    method();
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+  emitByte(OP_POP);
+
+  currentClass = currentClass->enclosing;
+}
+
+void Parser::method() {
+  consume(TOKEN_IDENTIFIER, "Expect method name.");
+  uint8_t constant = identifierConstant(previous);
+
+  FunctionType type = FunctionType::Method;
+  if (previous.str == "init") {
+    type = FunctionType::Initializer;
+  }
+  function(type);
+  emitBytes(OP_METHOD, constant);
+}
+
+void Parser::funDeclaration() {
+  int global = parseVariable("Expect function name.");
+  markInitialized();
+  function(FunctionType::Function);
+  defineVariable(global);
+}
+
+void Parser::function(FunctionType type) {
+  if (lazy && skipping == 0) {
+    lazyFunction(type);
+    return;
+  }
+
+  Compiler compiler{};
+  initCompiler(compiler, type);
+  functionBody(compiler);
+
+  // No endScope(): the callee's slots are discarded by OP_RETURN.
+  ObjFunction *function = endCompiler();
+  emitConstant(function);
+}
+
+// Checks the body by compiling it into scratch functions that are thrown
+// away, and emits a placeholder with the body's location instead.
+void Parser::lazyFunction(FunctionType type) {
+  auto body = std::make_shared<LazyBody>(
+      LazyBody{source, sourceOffset + scanner->offset(current), 0,
+               current.line, type, currentClass != nullptr});
+  ObjFunction *function = heap.allocate<ObjFunction>();
+  function->name = previous.str;
+
+  skipping++;
+  Compiler compiler{};
+  initCompiler(compiler, type);
+  functionBody(compiler);
+  function->arity = endCompiler()->arity;
+  skipping--;
+  scratch.clear();
+
+  body->end = sourceOffset + scanner->offset(previous) + previous.str.size();
+  function->lazy = std::move(body);
+  emitConstant(function);
+}
+
+void Parser::functionBody(Compiler &compiler) {
+  beginScope();
+
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check(TOKEN_RIGHT_PAREN)) {
+    do {
+      compiler.function->arity++;
+      if (compiler.function->arity > 255) {
+        errorAtCurrent("Can't have more than 255 parameters.");
+      }
+      int param = parseVariable("Expect parameter name.");
+      defineVariable(param);
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+  block();
+}
+
+void Parser::varDeclaration() {
+  int global = parseVariable("Expect variable name.");
+
+  if (match(TOKEN_EQUAL)) {
+    expression();
+  } else {
+    emitByte(OP_NIL);
+  }
+  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+  defineVariable(global);
+}
+
+void Parser::statement() {
+  if (match(TOKEN_PRINT)) {
+    printStatement();
+  } else if (match(TOKEN_IF)) {
+    ifStatement();
+  } else if (match(TOKEN_WHILE)) {
+    whileStatement();
+  } else if (match(TOKEN_FOR)) {
+    forStatement();
+  } else if (match(TOKEN_RETURN)) {
+    returnStatement();
+  } else if (match(TOKEN_LEFT_BRACE)) {
+    beginScope();
+    block();
+    endScope();
+  } else {
+    expressionStatement();
+  }
+}
+
+void Parser::printStatement() {
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after value.");
+  emitByte(OP_PRINT);
+}
+
+void Parser::ifStatement() {
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression();
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  size_t thenJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+  statement();
+
+  size_t elseJump = emitJump(OP_JUMP);
+  patchJump(thenJump);
+  emitByte(OP_POP);
+
+  if (match(TOKEN_ELSE)) {
+    statement();
+  }
+  patchJump(elseJump);
+}
+
+void Parser::whileStatement() {
+  size_t loopStart = currentChunk().codes.size();
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression();
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  size_t exitJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+  statement();
+  emitLoop(loopStart);
+
+  patchJump(exitJump);
+  emitByte(OP_POP);
+}
+
+void Parser::forStatement() {
+  beginScope();
+  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(TOKEN_SEMICOLON)) {
+    // No initializer.
+  } else if (match(TOKEN_VAR)) {
+    varDeclaration();
+  } else {
+    expressionStatement();
+  }
+
+  size_t loopStart = currentChunk().codes.size();
+  size_t exitJump = SIZE_MAX;
+  if (!match(TOKEN_SEMICOLON)) {
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+
+    exitJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+  }
+
+  // The increment is compiled before the body but runs after it, so the
+  // body jumps over it on the way in and loops back to it afterwards.
+  if (!match(TOKEN_RIGHT_PAREN)) {
+    size_t bodyJump = emitJump(OP_JUMP);
+    size_t incrementStart = currentChunk().codes.size();
+    expression();
+    emitByte(OP_POP);
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    emitLoop(loopStart);
+    loopStart = incrementStart;
+    patchJump(bodyJump);
+  }
+
+  statement();
+  emitLoop(loopStart);
+
+  if (exitJump != SIZE_MAX) {
+    patchJump(exitJump);
+    emitByte(OP_POP);
+  }
+  endScope();
+}
+
+void Parser::returnStatement() {
+  if (compiler->type == FunctionType::Script) {
+    error("Can't return from top-level code.");
+  }
+
+  if (match(TOKEN_SEMICOLON)) {
+    emitReturn();
+    return;
+  }
+
+  if (compiler->type == FunctionType::Initializer) {
+    error("Can't return a value from an initializer.");
+  }
+
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+  // A call whose result is returned directly can reuse the caller's frame.
+  Chunk &chunk = currentChunk();
+  if (compiler->lastCall != SIZE_MAX &&
+      compiler->lastCall + 2 == chunk.codes.size()) {
+    chunk.codes[compiler->lastCall] = OP_TAIL_CALL;
+  }
+  emitByte(OP_RETURN);
+}
+
+void Parser::expressionStatement() {
+  expression();
+  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+  emitByte(OP_POP);
+}
+
+void Parser::block() {
+  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+    declaration();
+  }
+
+  consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+void Parser::beginScope() { compiler->scopeDepth++; }
+
+void Parser::endScope() {
+  compiler->scopeDepth--;
+
+  int popped = 0;
+  while (!compiler->locals.empty() &&
+         compiler->locals.back().depth > compiler->scopeDepth) {
+    compiler->locals.pop_back();
+    popped++;
+  }
+  emitPops(popped);
+}
+
+void Parser::synchronize() {
+  panicMode = false;
+
+  while (current.type != TOKEN_EOF) {
+    if (previous.type == TOKEN_SEMICOLON) {
+      return;
+    }
+    switch (current.type) {
+    case TOKEN_CLASS:
+    case TOKEN_FUN:
+    case TOKEN_VAR:
+    case TOKEN_FOR:
+    case TOKEN_IF:
+    case TOKEN_WHILE:
+    case TOKEN_PRINT:
+    case TOKEN_RETURN:
+      return;
+    default:
+      break;
+    }
+
+    advance();
+  }
+}
+
+uint8_t Parser::identifierConstant(Token const &name) {
+  return stringConstant(name.str);
+}
+
+// While pre-parsing, a placeholder keeps the constant count honest.
+uint8_t Parser::stringConstant(std::string_view chars) {
+  if (skipping > 0) {
+    return makeConstant(Nil{});
+  }
+  return makeConstant(heap.intern(chars));
+}
+
+int Parser::resolveGlobal(std::string_view name) {
+  if (skipping > 0) {
+    return 0;
+  }
+  ObjString *string = heap.intern(name);
+  if (globals.find(string) == nullptr &&
+      globals.size() == Globals::MAX_SLOTS) {
+    error("Too many global variables.");
+    return 0;
+  }
+  return globals.resolve(string);
+}
+
+uint16_t Parser::makeCache() {
+  if (currentChunk().caches.size() > UINT16_MAX) {
+    error("Too many property accesses in one chunk.");
+    return 0;
+  }
+
+  return currentChunk().addCache();
+}
+
+int Parser::parseVariable(std::string const &errorMessage) {
+  consume(TOKEN_IDENTIFIER, errorMessage);
+
+  declareVariable();
+  if (compiler->scopeDepth > 0) {
+    return 0;
+  }
+
+  return resolveGlobal(previous.str);
+}
+
+void Parser::declareVariable() {
+  if (compiler->scopeDepth == 0) {
+    return;
+  }
+
+  Token const &name = previous;
+  for (auto local = compiler->locals.rbegin();
+       local != compiler->locals.rend(); ++local) {
+    if (local->depth != -1 && local->depth < compiler->scopeDepth) {
+      break;
+    }
+
+    if (name.str == local->name) {
+      error("Already a variable with this name in this scope.");
+    }
+  }
+
+  addLocal(name);
+}
+
+void Parser::addLocal(Token const &name) {
+  if (compiler->locals.size() > UINT16_MAX) {
+    error("Too many local variables in function.");
+    return;
+  }
+
+  compiler->locals.push_back(Local{std::string{name.str}, -1});
+}
+
+void Parser::markInitialized() {
+  if (compiler->scopeDepth == 0) {
+    return;
+  }
+  compiler->locals.back().depth = compiler->scopeDepth;
+}
+
+void Parser::defineVariable(int global) {
+  if (compiler->scopeDepth > 0) {
+    markInitialized();
+    return;
+  }
+
+  emitByte(OP_DEFINE_GLOBAL);
+  emitShort(global);
+}
+
+int Parser::resolveLocal(Compiler &compiler, Token const &name) {
+  for (int i = compiler.locals.size() - 1; i >= 0; i--) {
+    Local const &local = compiler.locals[i];
+    if (name.str == local.name) {
+      if (local.depth == -1) {
+        error("Can't read local variable in its own initializer.");
+      }
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+void Parser::variable(bool canAssign) { namedVariable(previous, canAssign); }
+
+void Parser::namedVariable(Token name, bool canAssign) {
+  int slot = resolveLocal(*compiler, name);
+  bool isLocal = slot != -1;
+
+  if (!isLocal) {
+    // The script's own locals are those of its blocks, which a function
+    // declared in one can't reach either.
+    for (Compiler *outer = compiler->enclosing; outer != nullptr;
+         outer = outer->enclosing) {
+      if (resolveLocal(*outer, name) != -1) {
+        error("Can't capture local variables of an enclosing function.");
+        return;
+      }
+    }
+  }
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    expression();
+    if (isLocal) {
+      emitLocalOp(OP_SET_LOCAL, OP_SET_LOCAL_LONG, slot);
+    } else {
+      emitByte(OP_SET_GLOBAL);
+      emitShort(resolveGlobal(name.str));
+    }
+  } else if (isLocal) {
+    emitLocalOp(OP_GET_LOCAL, OP_GET_LOCAL_LONG, slot);
+  } else {
+    emitByte(OP_GET_GLOBAL);
+    emitShort(resolveGlobal(name.str));
+  }
+}
+
 void Parser::expression() { parsePrecedence(Precedence::assignment); }
-void Parser::number() {
-  double value = std::stod(previous.str);
-  emitConstant(value);
+void Parser::number(bool) {
+  emitConstant(parseNumber(previous.str));
 }
 
 void Parser::emitConstant(Value value) {
@@ -111,12 +734,12 @@ uint8_t Parser::makeConstant(Value value) {
   return constant;
 }
 
-void Parser::grouping() {
+void Parser::grouping(bool) {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-void Parser::unary() {
+void Parser::unary(bool) {
   TokenType operatorType = previous.type;
 
   // compile the operand
@@ -134,7 +757,7 @@ void Parser::unary() {
   }
 }
 
-void Parser::binary() {
+void Parser::binary(bool) {
   TokenType operatorType = previous.type;
   ParseRule rule = getRule(operatorType);
   parsePrecedence(nextEnum(rule.precedence));
@@ -160,34 +783,115 @@ void Parser::binary() {
     break;
   case TOKEN_PLUS:
     emitByte(OP_ADD);
+    break;
   case TOKEN_MINUS:
     emitByte(OP_SUBTRACT);
+    break;
   case TOKEN_STAR:
     emitByte(OP_MULTIPLY);
+    break;
   case TOKEN_SLASH:
     emitByte(OP_DIVIDE);
+    break;
   default:
     return;
   }
 }
 
-void Parser::literal() {
+void Parser::call(bool) {
+  uint8_t argCount = argumentList();
+  compiler->lastCall = currentChunk().codes.size();
+  emitBytes(OP_CALL, argCount);
+}
+
+uint8_t Parser::argumentList() {
+  uint8_t argCount = 0;
+  if (!check(TOKEN_RIGHT_PAREN)) {
+    do {
+      expression();
+      if (argCount == 255) {
+        error("Can't have more than 255 arguments.");
+      }
+      argCount++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  return argCount;
+}
+
+void Parser::dot(bool canAssign) {
+  consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
+  uint8_t name = identifierConstant(previous);
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    expression();
+    emitBytes(OP_SET_PROPERTY, name);
+    emitShort(makeCache());
+  } else if (match(TOKEN_LEFT_PAREN)) {
+    uint8_t argCount = argumentList();
+    emitBytes(OP_INVOKE, name);
+    emitByte(argCount);
+    emitShort(makeCache());
+  } else {
+    emitBytes(OP_GET_PROPERTY, name);
+    emitShort(makeCache());
+  }
+}
+
+void Parser::string(bool) {
+  std::string_view body = previous.str.substr(1, previous.str.size() - 2);
+  emitBytes(OP_CONSTANT, stringConstant(body));
+}
+
+void Parser::this_(bool) {
+  if (currentClass == nullptr) {
+    error("Can't use 'this' outside of a class.");
+    return;
+  }
+
+  variable(false);
+}
+
+void Parser::literal(bool) {
   switch (previous.type) {
   case TOKEN_FALSE:
     emitByte(OP_FALSE);
+    break;
   case TOKEN_NIL:
     emitByte(OP_NIL);
+    break;
   case TOKEN_TRUE:
     emitByte(OP_TRUE);
+    break;
   default:
     return;
   }
 }
 
+void Parser::and_(bool) {
+  size_t endJump = emitJump(OP_JUMP_IF_FALSE);
+
+  emitByte(OP_POP);
+  parsePrecedence(Precedence::AND);
+
+  patchJump(endJump);
+}
+
+void Parser::or_(bool) {
+  size_t elseJump = emitJump(OP_JUMP_IF_FALSE);
+  size_t endJump = emitJump(OP_JUMP);
+
+  patchJump(elseJump);
+  emitByte(OP_POP);
+
+  parsePrecedence(Precedence::OR);
+  patchJump(endJump);
+}
+
 ParseRule Parser::getRule(TokenType type) {
   switch (type) {
   case TOKEN_LEFT_PAREN:
-    return {&Parser::grouping, nullptr, Precedence::none};
+    return {&Parser::grouping, &Parser::call, Precedence::call};
   case TOKEN_RIGHT_PAREN:
     return {nullptr, nullptr, Precedence::none};
   case TOKEN_LEFT_BRACE:
@@ -197,7 +901,7 @@ ParseRule Parser::getRule(TokenType type) {
   case TOKEN_COMMA:
     return {nullptr, nullptr, Precedence::none};
   case TOKEN_DOT:
-    return {nullptr, nullptr, Precedence::none};
+    return {nullptr, &Parser::dot, Precedence::call};
   case TOKEN_MINUS:
     return {&Parser::unary, &Parser::binary, Precedence::term};
   case TOKEN_PLUS:
@@ -225,13 +929,13 @@ ParseRule Parser::getRule(TokenType type) {
   case TOKEN_LESS_EQUAL:
     return {nullptr, &Parser::binary, Precedence::comparison};
   case TOKEN_IDENTIFIER:
-    return {nullptr, nullptr, Precedence::none};
+    return {&Parser::variable, nullptr, Precedence::none};
   case TOKEN_STRING:
-    return {nullptr, nullptr, Precedence::none};
+    return {&Parser::string, nullptr, Precedence::none};
   case TOKEN_NUMBER:
     return {&Parser::number, nullptr, Precedence::none};
   case TOKEN_AND:
-    return {nullptr, nullptr, Precedence::none};
+    return {nullptr, &Parser::and_, Precedence::AND};
   case TOKEN_CLASS:
     return {nullptr, nullptr, Precedence::none};
   case TOKEN_ELSE:
@@ -247,7 +951,7 @@ ParseRule Parser::getRule(TokenType type) {
   case TOKEN_NIL:
     return {&Parser::literal, nullptr, Precedence::none};
   case TOKEN_OR:
-    return {nullptr, nullptr, Precedence::none};
+    return {nullptr, &Parser::or_, Precedence::OR};
   case TOKEN_PRINT:
     return {nullptr, nullptr, Precedence::none};
   case TOKEN_RETURN:
@@ -255,7 +959,7 @@ ParseRule Parser::getRule(TokenType type) {
   case TOKEN_SUPER:
     return {nullptr, nullptr, Precedence::none};
   case TOKEN_THIS:
-    return {nullptr, nullptr, Precedence::none};
+    return {&Parser::this_, nullptr, Precedence::none};
   case TOKEN_TRUE:
     return {&Parser::literal, nullptr, Precedence::none};
   case TOKEN_VAR:
@@ -277,12 +981,17 @@ void Parser::parsePrecedence(Precedence precedence) {
     return error("Expect expression.");
   }
 
-  (this->*prefixRule)();
+  bool canAssign = precedence <= Precedence::assignment;
+  (this->*prefixRule)(canAssign);
 
   while (precedence <= getRule(current.type).precedence) {
     advance();
     ParseFn infixRule = getRule(previous.type).infix;
-    (this->*infixRule)();
+    (this->*infixRule)(canAssign);
+  }
+
+  if (canAssign && match(TOKEN_EQUAL)) {
+    error("Invalid assignment target.");
   }
 }
 } // namespace lox
\ No newline at end of file
@@ -2,13 +2,16 @@
 #define cpplox_compiler_h
 
 #include "chunk.h"
+#include "globals.h"
+#include "object.h"
 #include "scanner.h"
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 namespace lox {
 class Parser;
-using ParseFn = void (lox::Parser::*)();
+using ParseFn = void (lox::Parser::*)(bool canAssign);
 
 enum class Precedence {
   none,
@@ -30,29 +33,135 @@ struct ParseRule {
   Precedence precedence;
 };
 
+// Locals live directly in the VM's value stack. The compiler mirrors the
+// stack layout so every local resolves to a fixed slot index.
+struct Local {
+  std::string name;
+  int depth;
+};
+
+enum class FunctionType {
+  Function,
+  Initializer,
+  Method,
+  Script,
+};
+
+// The source of a function whose body is compiled on its first call. The
+// range runs from the '(' before the parameters to the closing '}'.
+struct LazyBody {
+  std::shared_ptr<std::string const> source;
+  size_t start;
+  size_t end;
+  int line;
+  FunctionType type;
+  // Methods, and functions nested in them, are compiled inside a class.
+  bool inClass;
+};
+
+struct Compiler {
+  Compiler *enclosing = nullptr;
+  ObjFunction *function = nullptr;
+  FunctionType type = FunctionType::Script;
+  std::vector<Local> locals;
+  int scopeDepth = 0;
+  // Offset of the most recent OP_CALL, used to spot calls in tail position.
+  size_t lastCall = SIZE_MAX;
+};
+
+struct ClassCompiler {
+  ClassCompiler *enclosing = nullptr;
+};
+
 class Parser {
 public:
-  bool compile(std::string const &src, Chunk &chunk);
+  // A lazy parser only pre-parses function bodies: it checks them for
+  // errors, but leaves a placeholder function that compileBody() fills in
+  // when it is first called.
+  Parser(Globals &globals, Heap &heap, OutputSink &out, bool lazy = false)
+      : globals{globals}, heap{heap}, out{out}, lazy{lazy} {}
+  ObjFunction *compile(std::string const &src);
+  // Compiles the body a placeholder stands for into a new function named
+  // name. Functions nested in it are left lazy in turn.
+  ObjFunction *compileBody(LazyBody const &body, std::string_view name);
 
 private:
   std::unique_ptr<Scanner> scanner;
-  Token current;
-  Token previous;
+  // Kept alive by lazy functions, which compile from it later.
+  std::shared_ptr<std::string const> source;
+  // Where the scanned text starts within source.
+  size_t sourceOffset = 0;
+  Token current{};
+  Token previous{};
   bool hadError = false;
   bool panicMode = false;
-  Chunk *compilingChunk;
+  Compiler *compiler = nullptr;
+  ClassCompiler *currentClass = nullptr;
+  Globals &globals;
+  Heap &heap;
+  // Destination for DEBUG_PRINT_CODE listings.
+  OutputSink &out;
+  bool lazy;
+  // Nonzero while pre-parsing a function body. Code still goes to scratch
+  // functions, so every compile error is found, but nothing is interned,
+  // resolved or allocated on the heap.
+  int skipping = 0;
+  std::vector<std::unique_ptr<ObjFunction>> scratch;
+
+  void initCompiler(Compiler &compiler, FunctionType type);
+  void declaration();
+  void classDeclaration();
+  void method();
+  void funDeclaration();
+  void varDeclaration();
+  void function(FunctionType type);
+  void lazyFunction(FunctionType type);
+  void functionBody(Compiler &compiler);
+  void statement();
+  void printStatement();
+  void ifStatement();
+  void whileStatement();
+  void forStatement();
+  void returnStatement();
+  void expressionStatement();
+  void block();
+  void beginScope();
+  void endScope();
+  void synchronize();
 
   void expression();
-  void number();
-  void grouping();
-  void unary();
-  void binary();
-  void literal();
+  void number(bool canAssign);
+  void grouping(bool canAssign);
+  void unary(bool canAssign);
+  void binary(bool canAssign);
+  void call(bool canAssign);
+  void dot(bool canAssign);
+  void string(bool canAssign);
+  void this_(bool canAssign);
+  void literal(bool canAssign);
+  void and_(bool canAssign);
+  void or_(bool canAssign);
+  void variable(bool canAssign);
+  void namedVariable(Token name, bool canAssign);
   void parsePrecedence(Precedence precedence);
 
+  uint8_t identifierConstant(Token const &name);
+  uint8_t stringConstant(std::string_view chars);
+  int resolveGlobal(std::string_view name);
+  uint16_t makeCache();
+  int parseVariable(std::string const &errorMessage);
+  void declareVariable();
+  void addLocal(Token const &name);
+  void markInitialized();
+  void defineVariable(int global);
+  int resolveLocal(Compiler &compiler, Token const &name);
+  uint8_t argumentList();
+
   void advance();
   void consume(TokenType, std::string const &message);
-  void endCompiler();
+  bool check(TokenType type);
+  bool match(TokenType type);
+  ObjFunction *endCompiler();
 
   void errorAtCurrent(std::string message);
   void error(std::string message);
@@ -61,6 +170,12 @@ private:
   Chunk &currentChunk();
   void emitByte(uint8_t byte);
   void emitBytes(uint8_t a, uint8_t b);
+  void emitShort(uint16_t value);
+  void emitLocalOp(OpCode shortOp, OpCode longOp, int slot);
+  void emitPops(int count);
+  size_t emitJump(OpCode instruction);
+  void patchJump(size_t offset);
+  void emitLoop(size_t loopStart);
   void emitConstant(Value);
   void emitReturn();
   uint8_t makeConstant(Value value);
@@ -1,81 +1,167 @@
 #include "debug.h"
 
 #include <cstddef>
-#include <iomanip>
-#include <iostream>
 
 #include "chunk.h"
+#include "output.h"
 #include "value.h"
 
 namespace lox {
 
 namespace {
-void simpleInstruction(std::string name, std::size_t &offset) {
-  std::cout << name << "\n";
+void simpleInstruction(OutputSink &out, std::string name, std::size_t &offset) {
+  out.write(name);
+  out.put('\n');
   offset += 1;
 }
 
-void constantInstruction(std::string name, Chunk &chunk, size_t &offset) {
+void constantInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
   auto constantIdx = chunk.codes[offset + 1];
-  std::printf("%-16s %4d '", name.c_str(), constantIdx);
-  printValue(chunk.constants[constantIdx]);
-  std::printf("'\n");
+  out.format("%-16s %4d '", name.c_str(), constantIdx);
+  printValue(out, chunk.constants[constantIdx]);
+  out.write("'\n");
   offset += 2;
 }
 
+void byteInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto slot = chunk.codes[offset + 1];
+  out.format("%-16s %4d\n", name.c_str(), slot);
+  offset += 2;
+}
+
+void shortInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto slot = (chunk.codes[offset + 1] << 8) | chunk.codes[offset + 2];
+  out.format("%-16s %4d\n", name.c_str(), slot);
+  offset += 3;
+}
+
+void jumpInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto jump = (chunk.codes[offset + 1] << 8) | chunk.codes[offset + 2];
+  out.format("%-16s %4zu -> %zu\n", name.c_str(), offset, offset + 3 + jump);
+  offset += 3;
+}
+
+void loopInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto jump = (chunk.codes[offset + 1] << 8) | chunk.codes[offset + 2];
+  auto site = (chunk.codes[offset + 3] << 8) | chunk.codes[offset + 4];
+  out.format("%-16s %4zu -> %zu loop %d\n", name.c_str(), offset,
+             offset + 5 - jump, site);
+  offset += 5;
+}
+
+void propertyInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto constantIdx = chunk.codes[offset + 1];
+  auto cacheIdx = (chunk.codes[offset + 2] << 8) | chunk.codes[offset + 3];
+  out.format("%-16s %4d '", name.c_str(), constantIdx);
+  printValue(out, chunk.constants[constantIdx]);
+  out.format("' ic %d\n", cacheIdx);
+  offset += 4;
+}
+
+void invokeInstruction(OutputSink &out, std::string name, Chunk &chunk, size_t &offset) {
+  auto constantIdx = chunk.codes[offset + 1];
+  auto argCount = chunk.codes[offset + 2];
+  auto cacheIdx = (chunk.codes[offset + 3] << 8) | chunk.codes[offset + 4];
+  out.format("%-16s (%d args) %4d '", name.c_str(), argCount, constantIdx);
+  printValue(out, chunk.constants[constantIdx]);
+  out.format("' ic %d\n", cacheIdx);
+  offset += 5;
+}
+
 } // namespace
 
-void disassembleChunk(Chunk &chunk, std::string name) {
-  std::cout << name << "\n";
+void disassembleChunk(OutputSink &out, Chunk &chunk, std::string name) {
+  out.write(name);
+  out.put('\n');
 
   for (size_t offset = 0; offset < chunk.codes.size();) {
-    disassembleInstruction(chunk, offset);
+    disassembleInstruction(out, chunk, offset);
   }
 }
 
-void disassembleInstruction(Chunk &chunk, size_t &offset) {
-  std::cout << std::setw(4) << std::setfill('0') << offset << ' ';
+void disassembleInstruction(OutputSink &out, Chunk &chunk, size_t &offset) {
+  out.format("%04zu ", offset);
 
   if (offset > 0 && chunk.getLine(offset) == chunk.getLine(offset - 1)) {
-    std::printf("   | ");
+    out.write("   | ");
   } else {
-    printf("%4ld ", chunk.getLine(offset));
+    out.format("%4zu ", chunk.getLine(offset));
   }
 
   auto instruction = chunk.codes[offset];
 
   switch (instruction) {
   case OP_CONSTANT:
-    constantInstruction("OP_CONSTANT", chunk, offset);
+    constantInstruction(out, "OP_CONSTANT", chunk, offset);
     break;
   case OP_NIL:
-    return simpleInstruction("OP_NIL", offset);
+    return simpleInstruction(out, "OP_NIL", offset);
   case OP_TRUE:
-    return simpleInstruction("OP_TRUE", offset);
+    return simpleInstruction(out, "OP_TRUE", offset);
   case OP_FALSE:
-    return simpleInstruction("OP_FALSE", offset);
+    return simpleInstruction(out, "OP_FALSE", offset);
   case OP_EQUAL:
-    return simpleInstruction("OP_EQUAL", offset);
+    return simpleInstruction(out, "OP_EQUAL", offset);
   case OP_GREATER:
-    return simpleInstruction("OP_GREATER", offset);
+    return simpleInstruction(out, "OP_GREATER", offset);
   case OP_LESS:
-    return simpleInstruction("OP_LESS", offset);
+    return simpleInstruction(out, "OP_LESS", offset);
   case OP_ADD:
-    return simpleInstruction("OP_ADD", offset);
+    return simpleInstruction(out, "OP_ADD", offset);
   case OP_SUBTRACT:
-    return simpleInstruction("OP_SUBTRACT", offset);
+    return simpleInstruction(out, "OP_SUBTRACT", offset);
   case OP_MULTIPLY:
-    return simpleInstruction("OP_MULTIPLY", offset);
+    return simpleInstruction(out, "OP_MULTIPLY", offset);
   case OP_DIVIDE:
-    return simpleInstruction("OP_DIVIDE", offset);
+    return simpleInstruction(out, "OP_DIVIDE", offset);
   case OP_NOT:
-    return simpleInstruction("OP_NOT", offset);
+    return simpleInstruction(out, "OP_NOT", offset);
   case OP_NEGATE:
-    return simpleInstruction("OP_NEGATE", offset);
+    return simpleInstruction(out, "OP_NEGATE", offset);
+  case OP_PRINT:
+    return simpleInstruction(out, "OP_PRINT", offset);
+  case OP_POP:
+    return simpleInstruction(out, "OP_POP", offset);
+  case OP_POPN:
+    return byteInstruction(out, "OP_POPN", chunk, offset);
+  case OP_DEFINE_GLOBAL:
+    return shortInstruction(out, "OP_DEFINE_GLOBAL", chunk, offset);
+  case OP_GET_GLOBAL:
+    return shortInstruction(out, "OP_GET_GLOBAL", chunk, offset);
+  case OP_SET_GLOBAL:
+    return shortInstruction(out, "OP_SET_GLOBAL", chunk, offset);
+  case OP_GET_LOCAL:
+    return byteInstruction(out, "OP_GET_LOCAL", chunk, offset);
+  case OP_SET_LOCAL:
+    return byteInstruction(out, "OP_SET_LOCAL", chunk, offset);
+  case OP_GET_LOCAL_LONG:
+    return shortInstruction(out, "OP_GET_LOCAL_LONG", chunk, offset);
+  case OP_SET_LOCAL_LONG:
+    return shortInstruction(out, "OP_SET_LOCAL_LONG", chunk, offset);
+  case OP_JUMP:
+    return jumpInstruction(out, "OP_JUMP", chunk, offset);
+  case OP_JUMP_IF_FALSE:
+    return jumpInstruction(out, "OP_JUMP_IF_FALSE", chunk, offset);
+  case OP_LOOP:
+    return loopInstruction(out, "OP_LOOP", chunk, offset);
+  case OP_CALL:
+    return byteInstruction(out, "OP_CALL", chunk, offset);
+  case OP_TAIL_CALL:
+    return byteInstruction(out, "OP_TAIL_CALL", chunk, offset);
+  case OP_CLASS:
+    return constantInstruction(out, "OP_CLASS", chunk, offset);
+  case OP_METHOD:
+    return constantInstruction(out, "OP_METHOD", chunk, offset);
+  case OP_GET_PROPERTY:
+    return propertyInstruction(out, "OP_GET_PROPERTY", chunk, offset);
+  case OP_SET_PROPERTY:
+    return propertyInstruction(out, "OP_SET_PROPERTY", chunk, offset);
+  case OP_INVOKE:
+    return invokeInstruction(out, "OP_INVOKE", chunk, offset);
   case OP_RETURN:
-    return simpleInstruction("OP_RETURN", offset);
+    return simpleInstruction(out, "OP_RETURN", offset);
   default:
-    std::cout << "Unknown opcode " << instruction << "\n";
+    out.format("Unknown opcode %d\n", instruction);
     offset += 1;
     break;
   }
@@ -5,10 +5,12 @@
 #include <string>
 
 #include "chunk.h"
+#include "output.h"
 
 namespace lox {
-void disassembleChunk(Chunk &chunk, std::string name);
+void disassembleChunk(OutputSink &out, Chunk &chunk, std::string name);
 
-void disassembleInstruction(Chunk &chunk, std::size_t &offset);
+void disassembleInstruction(OutputSink &out, Chunk &chunk,
+                            std::size_t &offset);
 } // namespace lox
 #endif
\ No newline at end of file
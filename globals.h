@@ -0,0 +1,61 @@
+#ifndef cpplox_globals_h
+#define cpplox_globals_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "value.h"
+
+namespace lox {
+class ObjString;
+
+struct Global {
+  ObjString *name;
+  Value value;
+  bool defined = false;
+};
+
+// Global variables are resolved to a slot index at compile time, so the VM
+// reads and writes them by index instead of looking names up at runtime. The
+// table lives in the VM so that names survive between REPL lines. Names are
+// interned strings, so they are looked up by pointer.
+class Globals {
+public:
+  // Slot indices are 16-bit operands.
+  static constexpr size_t MAX_SLOTS = UINT16_MAX + 1;
+
+  explicit Globals(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : slots{memory}, indices{memory} {}
+
+  size_t resolve(ObjString *name) {
+    auto found = indices.find(name);
+    if (found != indices.end()) {
+      return found->second;
+    }
+
+    slots.push_back(Global{name, Nil{}, false});
+    indices.emplace(name, slots.size() - 1);
+    return slots.size() - 1;
+  }
+
+  // The slot for name, or nullptr if it has never been resolved.
+  Global *find(ObjString *name) {
+    auto found = indices.find(name);
+    return found == indices.end() ? nullptr : &slots[found->second];
+  }
+
+  Global &operator[](size_t index) { return slots[index]; }
+  size_t size() const { return slots.size(); }
+
+private:
+  std::pmr::vector<Global> slots;
+  std::pmr::unordered_map<ObjString *, size_t> indices;
+};
+
+} // namespace lox
+
+#endif
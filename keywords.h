@@ -0,0 +1,127 @@
+#ifndef cpplox_keywords_h
+#define cpplox_keywords_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "scanner.h"
+
+// Keyword recognition through a perfect hash that is searched for at compile
+// time. An identifier hashes on its length and first and last characters to
+// a single table slot, and one length check plus memcmp decides the token.
+namespace lox::keywords {
+
+struct Keyword {
+  std::string_view text;
+  TokenType type;
+};
+
+constexpr std::array<Keyword, 16> KEYWORDS{{
+    {"and", TOKEN_AND},
+    {"class", TOKEN_CLASS},
+    {"else", TOKEN_ELSE},
+    {"false", TOKEN_FALSE},
+    {"for", TOKEN_FOR},
+    {"fun", TOKEN_FUN},
+    {"if", TOKEN_IF},
+    {"nil", TOKEN_NIL},
+    {"or", TOKEN_OR},
+    {"print", TOKEN_PRINT},
+    {"return", TOKEN_RETURN},
+    {"super", TOKEN_SUPER},
+    {"this", TOKEN_THIS},
+    {"true", TOKEN_TRUE},
+    {"var", TOKEN_VAR},
+    {"while", TOKEN_WHILE},
+}};
+
+static_assert(KEYWORDS.size() == TOKEN_WHILE - TOKEN_AND + 1,
+              "every keyword token needs an entry in KEYWORDS");
+
+constexpr unsigned TABLE_BITS = 5;
+constexpr size_t TABLE_SIZE = size_t{1} << TABLE_BITS;
+static_assert(TABLE_SIZE >= KEYWORDS.size(), "keyword table too small");
+
+constexpr uint32_t hash(uint32_t seed, char first, char last, size_t length) {
+  uint32_t key = (uint32_t(uint8_t(first)) << 16) |
+                 (uint32_t(uint8_t(last)) << 8) | uint32_t(length & 0xff);
+  return (key * seed) >> (32 - TABLE_BITS);
+}
+
+constexpr uint32_t hash(uint32_t seed, std::string_view text) {
+  return hash(seed, text.front(), text.back(), text.size());
+}
+
+constexpr bool isPerfect(uint32_t seed) {
+  std::array<bool, TABLE_SIZE> used{};
+  for (Keyword const &keyword : KEYWORDS) {
+    uint32_t slot = hash(seed, keyword.text);
+    if (used[slot]) {
+      return false;
+    }
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr uint32_t findSeed() {
+  for (uint32_t seed = 1; seed < 1000000; seed += 2) {
+    if (isPerfect(seed)) {
+      return seed;
+    }
+  }
+  return 0;
+}
+
+constexpr uint32_t SEED = findSeed();
+static_assert(SEED != 0, "no perfect hash seed for the keyword set");
+
+constexpr std::array<Keyword, TABLE_SIZE> buildTable() {
+  std::array<Keyword, TABLE_SIZE> table{};
+  for (Keyword &slot : table) {
+    slot = {"", TOKEN_IDENTIFIER};
+  }
+  for (Keyword const &keyword : KEYWORDS) {
+    table[hash(SEED, keyword.text)] = keyword;
+  }
+  return table;
+}
+
+constexpr std::array<Keyword, TABLE_SIZE> TABLE = buildTable();
+
+constexpr size_t minLength() {
+  size_t length = SIZE_MAX;
+  for (Keyword const &keyword : KEYWORDS) {
+    length = keyword.text.size() < length ? keyword.text.size() : length;
+  }
+  return length;
+}
+
+constexpr size_t maxLength() {
+  size_t length = 0;
+  for (Keyword const &keyword : KEYWORDS) {
+    length = keyword.text.size() > length ? keyword.text.size() : length;
+  }
+  return length;
+}
+
+inline TokenType classify(char const *start, size_t length) {
+  if (length < minLength() || length > maxLength()) {
+    return TOKEN_IDENTIFIER;
+  }
+
+  Keyword const &candidate =
+      TABLE[hash(SEED, start[0], start[length - 1], length)];
+  if (candidate.text.size() == length &&
+      std::memcmp(candidate.text.data(), start, length) == 0) {
+    return candidate.type;
+  }
+  return TOKEN_IDENTIFIER;
+}
+
+} // namespace lox::keywords
+
+#endif
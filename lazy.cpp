@@ -0,0 +1,268 @@
+#include "lazy.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "compiler.h"
+#include "verifier.h"
+
+namespace lox {
+
+namespace {
+
+// A function nested in a template, located relative to the body holding it.
+struct NestedFunction {
+  std::string name;
+  int arity;
+  size_t start;
+  size_t end;
+  int line;
+  FunctionType type;
+  bool inClass;
+};
+
+using TemplateConstant =
+    std::variant<double, int64_t, std::string, NestedFunction>;
+
+// A global operand in the code, which each VM resolves to its own index.
+struct GlobalOperand {
+  size_t offset;
+  std::string name;
+};
+
+struct BodyTemplate {
+  std::vector<uint8_t> codes;
+  // Run-length pairs as in Chunk::lines, counting lines from the body's
+  // first.
+  std::vector<size_t> lines;
+  std::vector<TemplateConstant> constants;
+  std::vector<GlobalOperand> globals;
+  size_t caches = 0;
+  size_t loops = 0;
+};
+
+// Roughly what a cached template holds on to, counting its key.
+size_t footprint(std::string const &key, BodyTemplate const &body) {
+  size_t bytes = sizeof(BodyTemplate) + key.size() + body.codes.size() +
+                 body.lines.size() * sizeof(size_t) +
+                 body.constants.size() * sizeof(TemplateConstant) +
+                 body.globals.size() * sizeof(GlobalOperand);
+  for (TemplateConstant const &constant : body.constants) {
+    if (std::string const *string = std::get_if<std::string>(&constant)) {
+      bytes += string->size();
+    } else if (auto nested = std::get_if<NestedFunction>(&constant)) {
+      bytes += nested->name.size();
+    }
+  }
+  for (GlobalOperand const &global : body.globals) {
+    bytes += global.name.size();
+  }
+  return bytes;
+}
+
+// Least recently used templates go first once the cache holds more than
+// COMPILE_CACHE_BYTES. VMs keep the bodies they have already linked, so
+// eviction only costs a later VM a compile.
+class CompileCache {
+public:
+  std::shared_ptr<BodyTemplate const> find(std::string const &key) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto found = index.find(key);
+    if (found == index.end()) {
+      return nullptr;
+    }
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->body;
+  }
+
+  // Another VM may have compiled the same body meanwhile; the first one in
+  // is kept.
+  std::shared_ptr<BodyTemplate const>
+  insert(std::string key, std::shared_ptr<BodyTemplate const> body) {
+    std::lock_guard<std::mutex> lock{mutex};
+    auto found = index.find(key);
+    if (found != index.end()) {
+      return found->second->body;
+    }
+    size_t size = footprint(key, *body);
+    entries.push_front(Entry{std::move(key), std::move(body), size});
+    index.emplace(entries.front().key, entries.begin());
+    bytes += size;
+    // The newest entry stays even if it alone is over the limit.
+    while (bytes > COMPILE_CACHE_BYTES && entries.size() > 1) {
+      Entry &oldest = entries.back();
+      bytes -= oldest.bytes;
+      index.erase(oldest.key);
+      entries.pop_back();
+    }
+    return entries.front().body;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock{mutex};
+    index.clear();
+    entries.clear();
+    bytes = 0;
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<BodyTemplate const> body;
+    size_t bytes;
+  };
+
+  std::mutex mutex;
+  // Most recently used first. List nodes don't move, so the index can
+  // view their keys.
+  std::list<Entry> entries;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+  size_t bytes = 0;
+};
+
+CompileCache &compileCache() {
+  static CompileCache cache;
+  return cache;
+}
+
+std::string_view bodyText(LazyBody const &body) {
+  return std::string_view{*body.source}.substr(body.start,
+                                               body.end - body.start);
+}
+
+uint16_t shortAt(Chunk const &chunk, size_t offset) {
+  return static_cast<uint16_t>((chunk.codes[offset] << 8) |
+                               chunk.codes[offset + 1]);
+}
+
+std::shared_ptr<BodyTemplate const>
+makeTemplate(LazyBody const &body, std::string_view name, OutputSink &out) {
+  // A throwaway heap and globals, so nothing compiled refers to a VM.
+  Heap heap;
+  Globals globals;
+  Parser parser{globals, heap, out, true};
+  ObjFunction *function = parser.compileBody(body, name);
+  if (function == nullptr) {
+    throw std::runtime_error("Can't compile '" + std::string{name} + "'.");
+  }
+
+  auto result = std::make_shared<BodyTemplate>();
+  Chunk const &chunk = function->chunk;
+  result->codes.assign(chunk.codes.begin(), chunk.codes.end());
+  for (size_t i = 0; i < chunk.lines.size(); i += 2) {
+    result->lines.push_back(chunk.lines[i]);
+    result->lines.push_back(chunk.lines[i + 1] - body.line);
+  }
+
+  for (Value const &constant : chunk.constants) {
+    if (double const *number = std::get_if<double>(&constant)) {
+      result->constants.emplace_back(*number);
+    } else if (int64_t const *integer = std::get_if<int64_t>(&constant)) {
+      result->constants.emplace_back(*integer);
+    } else if (isString(constant)) {
+      result->constants.emplace_back(std::string{asString(constant)->chars});
+    } else {
+      ObjFunction *nested = asFunction(constant);
+      LazyBody const &inner = *nested->lazy;
+      result->constants.emplace_back(NestedFunction{
+          std::string{nested->name}, nested->arity, inner.start - body.start,
+          inner.end - body.start, inner.line - body.line, inner.type,
+          inner.inClass});
+    }
+  }
+
+  for (size_t offset = 0; offset < chunk.codes.size();
+       offset += instructionLength(chunk.codes[offset])) {
+    uint8_t op = chunk.codes[offset];
+    if (op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL || op == OP_SET_GLOBAL) {
+      Global &global = globals[shortAt(chunk, offset + 1)];
+      result->globals.push_back(
+          GlobalOperand{offset + 1, std::string{global.name->chars}});
+    }
+  }
+
+  result->caches = chunk.caches.size();
+  result->loops = chunk.loops.size();
+  return result;
+}
+
+void link(BodyTemplate const &body, LazyBody const &lazy,
+          ObjFunction *function, Globals &globals, Heap &heap) {
+  Chunk &chunk = function->chunk;
+  chunk.codes.assign(body.codes.begin(), body.codes.end());
+  for (GlobalOperand const &operand : body.globals) {
+    ObjString *name = heap.intern(operand.name);
+    if (globals.find(name) == nullptr &&
+        globals.size() == Globals::MAX_SLOTS) {
+      throw std::runtime_error("Too many global variables.");
+    }
+    size_t index = globals.resolve(name);
+    chunk.codes[operand.offset] = (index >> 8) & 0xff;
+    chunk.codes[operand.offset + 1] = index & 0xff;
+  }
+
+  chunk.lines.clear();
+  for (size_t i = 0; i < body.lines.size(); i += 2) {
+    chunk.lines.push_back(body.lines[i]);
+    chunk.lines.push_back(body.lines[i + 1] + lazy.line);
+  }
+
+  struct Visitor {
+    LazyBody const &lazy;
+    Heap &heap;
+    Value operator()(double number) { return number; }
+    Value operator()(int64_t integer) { return integer; }
+    Value operator()(std::string const &string) { return heap.intern(string); }
+    Value operator()(NestedFunction const &nested) {
+      ObjFunction *function = heap.allocate<ObjFunction>();
+      function->name = nested.name;
+      function->arity = nested.arity;
+      function->lazy = std::make_shared<LazyBody>(LazyBody{
+          lazy.source, lazy.start + nested.start, lazy.start + nested.end,
+          lazy.line + nested.line, nested.type, nested.inClass});
+      return function;
+    }
+  };
+  chunk.constants.clear();
+  for (TemplateConstant const &constant : body.constants) {
+    chunk.constants.push_back(std::visit(Visitor{lazy, heap}, constant));
+  }
+
+  chunk.caches.assign(body.caches, InlineCache{});
+  chunk.loops.assign(body.loops, LoopSite{});
+}
+
+} // namespace
+
+void compileLazy(ObjFunction *function, Globals &globals, Heap &heap,
+                 OutputSink &out) {
+  std::shared_ptr<LazyBody> lazy = function->lazy;
+  // The same text compiles differently as an initializer, and 'this' is
+  // only valid inside a class.
+  std::string key{bodyText(*lazy)};
+  key += static_cast<char>(lazy->type);
+  key += lazy->inClass ? 'c' : 'f';
+
+  CompileCache &cache = compileCache();
+  std::shared_ptr<BodyTemplate const> body = cache.find(key);
+  if (body == nullptr) {
+    body = cache.insert(std::move(key),
+                        makeTemplate(*lazy, function->name, out));
+  }
+
+  link(*body, *lazy, function, globals, heap);
+  function->lazy = nullptr;
+  verifyFunction(function, globals.size());
+}
+
+void clearCompileCache() { compileCache().clear(); }
+
+} // namespace lox
@@ -0,0 +1,35 @@
+#ifndef cpplox_lazy_h
+#define cpplox_lazy_h
+
+#include <cstddef>
+
+#include "globals.h"
+#include "object.h"
+#include "output.h"
+
+namespace lox {
+
+// Lazy compilation. The VM compiles scripts with a lazy Parser, which only
+// pre-parses function bodies, so a library pays for compiling just the
+// functions that get called. A body is compiled on its first call into a
+// template that belongs to no VM: constants are plain numbers, strings and
+// nested placeholders, and global operands are recorded by name. Templates
+// are cached for the whole process by body text, so every VM calling the
+// same function links the cached template into its own heap and globals
+// instead of compiling it again. The cache drops the least recently used
+// templates past COMPILE_CACHE_BYTES.
+
+constexpr size_t COMPILE_CACHE_BYTES = 32 * 1024 * 1024;
+
+// Compiles the body of a lazy placeholder into its chunk and verifies it.
+// Throws std::runtime_error if the body doesn't compile.
+void compileLazy(ObjFunction *function, Globals &globals, Heap &heap,
+                 OutputSink &out);
+
+// Empties the compile cache, for hosts that drop the scripts whose
+// templates it holds.
+void clearCompileCache();
+
+} // namespace lox
+
+#endif
@@ -1,3 +1,4 @@
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -5,24 +6,141 @@
 #include <sstream>
 #include <string>
 
+#include "aot.h"
 #include "chunk.h"
 #include "debug.h"
+#include "profiler.h"
+#include "server.h"
+#include "snapshot.h"
 #include "vm.h"
 #include <fstream>
 
 static void repl(lox::VM &);
 static void runFile(lox::VM &, char *const);
+static std::string readFile(char *const);
+static void printHeapStats(lox::PoolStats const &stats);
+static void emitCpp(char *const path, char *const outPath);
+
+static void usage() {
+  fprintf(stderr, "Usage: clox [--profile out.folded] [--heap-limit bytes] "
+                  "[--heap-stats] [--load-snapshot in.snap] "
+                  "[--save-snapshot out.snap] [path]\n"
+                  "       clox --emit-cpp out.cpp path\n"
+                  "       clox --serve socket [--heap-limit bytes] "
+                  "[--time-limit seconds]\n");
+  exit(64);
+}
 
 int main(int argc, char **argv) {
+  char *path = nullptr;
+  char *profilePath = nullptr;
+  size_t heapLimit = 0;
+  char *loadPath = nullptr;
+  char *savePath = nullptr;
+  char *emitPath = nullptr;
+  char *servePath = nullptr;
+  bool heapStats = false;
+  char *timeLimit = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--profile" && i + 1 < argc) {
+      profilePath = argv[++i];
+    } else if (arg == "--load-snapshot" && i + 1 < argc) {
+      loadPath = argv[++i];
+    } else if (arg == "--save-snapshot" && i + 1 < argc) {
+      savePath = argv[++i];
+    } else if (arg == "--emit-cpp" && i + 1 < argc) {
+      emitPath = argv[++i];
+    } else if (arg == "--serve" && i + 1 < argc) {
+      servePath = argv[++i];
+    } else if (arg == "--heap-stats") {
+      heapStats = true;
+    } else if (arg == "--heap-limit" && i + 1 < argc) {
+      char *end;
+      heapLimit = std::strtoull(argv[++i], &end, 10);
+      if (*end != '\0' || heapLimit == 0) {
+        usage();
+      }
+    } else if (arg == "--time-limit" && i + 1 < argc) {
+      timeLimit = argv[++i];
+    } else if (path == nullptr && arg[0] != '-') {
+      path = argv[i];
+    } else {
+      usage();
+    }
+  }
+
+  if (emitPath != nullptr) {
+    if (path == nullptr || profilePath != nullptr || loadPath != nullptr ||
+        savePath != nullptr) {
+      usage();
+    }
+    emitCpp(path, emitPath);
+    return 0;
+  }
+
+  if (servePath != nullptr) {
+    if (path != nullptr || profilePath != nullptr || loadPath != nullptr ||
+        savePath != nullptr || emitPath != nullptr || heapStats) {
+      usage();
+    }
+    unsigned seconds = lox::DEFAULT_TIME_LIMIT_SECONDS;
+    if (timeLimit != nullptr) {
+      char *end;
+      unsigned long parsed = std::strtoul(timeLimit, &end, 10);
+      if (*end != '\0' || end == timeLimit || parsed > UINT_MAX) {
+        usage();
+      }
+      seconds = static_cast<unsigned>(parsed);
+    }
+    return lox::serve(servePath, heapLimit, seconds);
+  }
+
+  if (timeLimit != nullptr) {
+    usage();
+  }
+
   lox::VM vm{};
+  vm.memoryAccount().setLimit(heapLimit);
+  if (loadPath != nullptr) {
+    try {
+      lox::Snapshot::load(vm, loadPath);
+    } catch (lox::SnapshotError &e) {
+      std::cerr << e.what() << "\n";
+      exit(74);
+    }
+  }
+
+  std::unique_ptr<lox::Profiler> profiler;
+  if (profilePath != nullptr) {
+    profiler = std::make_unique<lox::Profiler>(vm);
+    profiler->start();
+  }
 
-  if (argc == 1) {
+  if (path == nullptr) {
     repl(vm);
-  } else if (argc == 2) {
-    runFile(vm, argv[1]);
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    runFile(vm, path);
+  }
+
+  if (savePath != nullptr) {
+    try {
+      lox::Snapshot::save(vm, savePath);
+    } catch (lox::SnapshotError &e) {
+      std::cerr << e.what() << "\n";
+      exit(74);
+    }
+  }
+
+  if (profiler != nullptr) {
+    profiler->stop();
+    std::ofstream out{profilePath};
+    profiler->writeFolded(out);
+  }
+
+  if (heapStats) {
+    printHeapStats(vm.heapStats());
   }
 
   return 0;
@@ -45,6 +163,40 @@ static void repl(lox::VM &vm) {
 }
 
 static void runFile(lox::VM &vm, char *const path) {
+  vm.interpret(readFile(path));
+}
+
+static void emitCpp(char *const path, char *const outPath) {
+  std::string src = readFile(path);
+  std::ostringstream code;
+  if (!lox::emitCpp(src, code)) {
+    exit(65);
+  }
+  std::ofstream out{outPath};
+  out << code.str();
+  if (!out) {
+    std::cerr << "Unable to write " << outPath << "\n";
+    exit(74);
+  }
+}
+
+static void printHeapStats(lox::PoolStats const &stats) {
+  fprintf(stderr,
+          "heap: %zu bytes in pages, %.1f%% in use, %.1f%% free-listed; "
+          "%zu bytes requested; %zu bytes in large blocks\n",
+          stats.pageBytes, stats.occupancy() * 100,
+          stats.fragmentation() * 100, stats.requestedBytes,
+          stats.largeBytes);
+  for (lox::PoolStats::Class const &sizeClass : stats.classes) {
+    if (sizeClass.pages != 0) {
+      fprintf(stderr, "  %4zu-byte blocks: %zu pages, %zu used, %zu free\n",
+              sizeClass.blockSize, sizeClass.pages, sizeClass.usedBlocks,
+              sizeClass.freeBlocks);
+    }
+  }
+}
+
+static std::string readFile(char *const path) {
   std::stringstream buffer;
   std::ifstream srcFile{path}; // open the file for reading
   if (!srcFile.is_open()) {
@@ -56,5 +208,5 @@ static void runFile(lox::VM &vm, char *const path) {
   std::string src = buffer.str();
   srcFile.close(); // close the file
 
-  vm.interpret(src);
+  return src;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include "map.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "vm.h"
+
+namespace lox {
+
+namespace {
+
+size_t toPosition(ObjMap *map, double position) {
+  if (!(position >= 0) || position != std::floor(position) ||
+      position >= static_cast<double>(map->table.capacity()) ||
+      !map->table.occupied(static_cast<size_t>(position))) {
+    throw std::runtime_error("No map entry at that position.");
+  }
+  return static_cast<size_t>(position);
+}
+
+ObjMap *makeMap(Heap &heap) { return heap.allocate<ObjMap>(); }
+
+Value put(ObjMap *map, Value key, Value value) {
+  map->table.set(key, value);
+  return value;
+}
+
+Value lookup(ObjMap *map, Value key) {
+  Value *value = map->table.find(key);
+  return value != nullptr ? *value : Nil{};
+}
+
+bool contains(ObjMap *map, Value key) {
+  return map->table.find(key) != nullptr;
+}
+
+bool remove(ObjMap *map, Value key) { return map->table.remove(key); }
+
+size_t size(ObjMap *map) { return map->table.size(); }
+
+Value next(ObjMap *map, double position) {
+  if (!(position >= -1) || position != std::floor(position)) {
+    throw std::runtime_error("Map position must be a whole number.");
+  }
+  Table &table = map->table;
+  if (position + 1 >= static_cast<double>(table.capacity())) {
+    return Nil{};
+  }
+  size_t found = table.next(static_cast<size_t>(position + 1));
+  if (found == table.capacity()) {
+    return Nil{};
+  }
+  return static_cast<int64_t>(found);
+}
+
+Value key(ObjMap *map, double position) {
+  return map->table.keyAt(toPosition(map, position));
+}
+
+Value value(ObjMap *map, double position) {
+  return map->table.valueAt(toPosition(map, position));
+}
+
+} // namespace
+
+void defineMapNatives(VM &vm) {
+  vm.defineNative("map", makeMap);
+  vm.defineNative("mapSet", put);
+  vm.defineNative("mapGet", lookup);
+  vm.defineNative("mapHas", contains);
+  vm.defineNative("mapRemove", remove);
+  vm.defineNative("mapSize", size);
+  vm.defineNative("mapNext", next);
+  vm.defineNative("mapKey", key);
+  vm.defineNative("mapValue", value);
+}
+
+} // namespace lox
@@ -0,0 +1,36 @@
+#ifndef cpplox_map_h
+#define cpplox_map_h
+
+#include "native.h"
+#include "object.h"
+
+namespace lox {
+class VM;
+
+template <> struct NativeType<ObjMap *> {
+  static ObjMap *unbox(ObjNative *native, Value value, size_t position) {
+    if (!isMap(value)) {
+      native->argumentError(position, "a map");
+    }
+    return asMap(value);
+  }
+  static Value box(Heap &, ObjMap *map) { return map; }
+};
+
+// Binds the map builtins, named like the array ones: map() makes an empty
+// map, mapSet(map, key, value) stores a value, mapGet(map, key) returns it
+// or nil, and mapHas(map, key), mapRemove(map, key) and mapSize(map) do
+// what they say. Any value but NaN can be a key. Entries are visited by
+// position:
+//
+//   for (var i = mapNext(m, -1); i != nil; i = mapNext(m, i))
+//     print mapKey(m, i) + ": " + mapValue(m, i);
+//
+// mapNext(map, position) returns the position of the entry after
+// position, or nil past the last. Removing entries while visiting is fine;
+// setting new keys may move the rest.
+void defineMapNatives(VM &vm);
+
+} // namespace lox
+
+#endif
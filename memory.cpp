@@ -0,0 +1,111 @@
+#include "memory.h"
+
+#include <string>
+
+namespace lox {
+
+void *MemoryAccount::do_allocate(size_t bytes, size_t alignment) {
+  size_t cap = baseBytes + limitBytes;
+  if (limitBytes != 0 && (live > cap || bytes > cap - live)) {
+    throw MemoryLimitError("Out of memory: heap limit of " +
+                           std::to_string(limitBytes) + " bytes exceeded.");
+  }
+
+  void *pointer = upstream->allocate(bytes, alignment);
+  live += bytes;
+  if (live > peak) {
+    peak = live;
+  }
+  return pointer;
+}
+
+void MemoryAccount::do_deallocate(void *pointer, size_t bytes,
+                                  size_t alignment) {
+  upstream->deallocate(pointer, bytes, alignment);
+  live -= bytes;
+}
+
+SizeClassPool::~SizeClassPool() {
+  for (void *page : pages) {
+    upstream->deallocate(page, PAGE_SIZE, GRANULE);
+  }
+}
+
+void SizeClassPool::refill(SizeClass &sizeClass, size_t blockSize) {
+  // Room for the page first, so a failed push can't leak it.
+  pages.push_back(nullptr);
+  char *page;
+  try {
+    page = static_cast<char *>(upstream->allocate(PAGE_SIZE, GRANULE));
+  } catch (...) {
+    pages.pop_back();
+    throw;
+  }
+  pages.back() = page;
+  sizeClass.bump = page;
+  sizeClass.end = page + PAGE_SIZE / blockSize * blockSize;
+  sizeClass.pages++;
+}
+
+void *SizeClassPool::do_allocate(size_t bytes, size_t alignment) {
+  if (bytes > MAX_BLOCK || alignment > GRANULE) {
+    void *pointer = upstream->allocate(bytes, alignment);
+    largeBytes += bytes;
+    return pointer;
+  }
+
+  size_t index = classIndex(bytes);
+  SizeClass &sizeClass = classes[index];
+  void *block;
+  if (sizeClass.free != nullptr) {
+    block = sizeClass.free;
+    sizeClass.free = sizeClass.free->next;
+    sizeClass.freeBlocks--;
+  } else {
+    size_t blockSize = (index + 1) * GRANULE;
+    if (sizeClass.bump == sizeClass.end) {
+      refill(sizeClass, blockSize);
+    }
+    block = sizeClass.bump;
+    sizeClass.bump += blockSize;
+  }
+  sizeClass.usedBlocks++;
+  requestedBytes += bytes;
+  return block;
+}
+
+void SizeClassPool::do_deallocate(void *pointer, size_t bytes,
+                                  size_t alignment) {
+  if (bytes > MAX_BLOCK || alignment > GRANULE) {
+    upstream->deallocate(pointer, bytes, alignment);
+    largeBytes -= bytes;
+    return;
+  }
+
+  SizeClass &sizeClass = classes[classIndex(bytes)];
+  auto block = static_cast<FreeBlock *>(pointer);
+  block->next = sizeClass.free;
+  sizeClass.free = block;
+  sizeClass.usedBlocks--;
+  sizeClass.freeBlocks++;
+  requestedBytes -= bytes;
+}
+
+PoolStats SizeClassPool::stats() const {
+  PoolStats stats;
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    SizeClass const &sizeClass = classes[i];
+    size_t blockSize = (i + 1) * GRANULE;
+    stats.classes.push_back(PoolStats::Class{blockSize, sizeClass.pages,
+                                             sizeClass.usedBlocks,
+                                             sizeClass.freeBlocks});
+    stats.usedBytes += sizeClass.usedBlocks * blockSize;
+    stats.freeBytes += sizeClass.freeBlocks * blockSize;
+  }
+  stats.pageBytes = pages.size() * PAGE_SIZE;
+  stats.requestedBytes = requestedBytes;
+  stats.largeBytes = largeBytes;
+  return stats;
+}
+
+} // namespace lox
@@ -0,0 +1,142 @@
+#ifndef cpplox_memory_h
+#define cpplox_memory_h
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
+namespace lox {
+
+class MemoryLimitError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// The memory resource every allocation made on behalf of one VM goes through:
+// chunks and constant pools, globals and heap objects. The value stack and
+// call frames, allocated once at their full size, are left out. It keeps
+// live and peak byte counts and enforces an optional hard limit by throwing
+// MemoryLimitError, which the VM reports as a runtime error.
+class MemoryAccount : public std::pmr::memory_resource {
+public:
+  explicit MemoryAccount(
+      std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+      : upstream{upstream} {}
+
+  // Limits the account to bytes more than are live now, so a VM's start-up
+  // state doesn't count against it. Zero means no limit.
+  void setLimit(size_t bytes) {
+    limitBytes = bytes;
+    baseBytes = live;
+  }
+  size_t limit() const { return limitBytes; }
+  size_t liveBytes() const { return live; }
+  size_t peakBytes() const { return peak; }
+  void resetPeak() { peak = live; }
+
+private:
+  std::pmr::memory_resource *upstream;
+  size_t limitBytes = 0;
+  size_t baseBytes = 0;
+  size_t live = 0;
+  size_t peak = 0;
+
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void *pointer, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      std::pmr::memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+// What a SizeClassPool holds. Pages are carved into blocks of one size
+// class; a block is in use, on its class's free list, or not yet reached
+// by the bump pointer.
+struct PoolStats {
+  struct Class {
+    size_t blockSize = 0;
+    size_t pages = 0;
+    size_t usedBlocks = 0;
+    size_t freeBlocks = 0;
+  };
+
+  std::vector<Class> classes;
+  // Bytes of pages taken from upstream.
+  size_t pageBytes = 0;
+  // Bytes in blocks handed out, and the part of them callers asked for.
+  size_t usedBytes = 0;
+  size_t requestedBytes = 0;
+  // Bytes in blocks freed and waiting for reuse.
+  size_t freeBytes = 0;
+  // Bytes of requests too large for any class, passed straight upstream.
+  size_t largeBytes = 0;
+
+  // The share of page bytes in use.
+  double occupancy() const {
+    return pageBytes == 0 ? 1.0 : static_cast<double>(usedBytes) / pageBytes;
+  }
+  // The share of page bytes stranded on free lists.
+  double fragmentation() const {
+    return pageBytes == 0 ? 0.0 : static_cast<double>(freeBytes) / pageBytes;
+  }
+};
+
+// A small-object allocator for one VM's heap. Requests are rounded up to a
+// multiple of GRANULE and served from that size class's free list, or else
+// bump-allocated from its current page; pages come from upstream a
+// PAGE_SIZE at a time and go back only when the pool is destroyed. Nothing
+// is locked: a VM's heap is only used from one thread at a time.
+class SizeClassPool : public std::pmr::memory_resource {
+public:
+  static constexpr size_t GRANULE = 16;
+  static constexpr size_t MAX_BLOCK = 256;
+  static constexpr size_t PAGE_SIZE = 4096;
+
+  explicit SizeClassPool(std::pmr::memory_resource *upstream)
+      : upstream{upstream} {}
+  SizeClassPool(SizeClassPool const &) = delete;
+  SizeClassPool &operator=(SizeClassPool const &) = delete;
+  ~SizeClassPool() override;
+
+  PoolStats stats() const;
+
+private:
+  static constexpr size_t CLASS_COUNT = MAX_BLOCK / GRANULE;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct SizeClass {
+    FreeBlock *free = nullptr;
+    char *bump = nullptr;
+    char *end = nullptr;
+    size_t pages = 0;
+    size_t usedBlocks = 0;
+    size_t freeBlocks = 0;
+  };
+
+  std::pmr::memory_resource *upstream;
+  std::array<SizeClass, CLASS_COUNT> classes;
+  std::vector<void *> pages;
+  size_t requestedBytes = 0;
+  size_t largeBytes = 0;
+
+  static size_t classIndex(size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / GRANULE;
+  }
+  void refill(SizeClass &sizeClass, size_t blockSize);
+
+  void *do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void *pointer, size_t bytes, size_t alignment) override;
+  bool do_is_equal(
+      std::pmr::memory_resource const &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+} // namespace lox
+
+#endif
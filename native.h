@@ -0,0 +1,143 @@
+#ifndef cpplox_native_h
+#define cpplox_native_h
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "number.h"
+#include "object.h"
+#include "value.h"
+
+namespace lox {
+
+// Converts script values to and from the parameter and return types of a
+// bound C++ function. Numbers map to any arithmetic type, and integral
+// results come back as integers where they fit; booleans map to bool,
+// strings to std::string_view or std::string, and Value passes through.
+template <typename T, typename = void> struct NativeType;
+
+template <> struct NativeType<Value> {
+  static Value unbox(ObjNative *, Value value, size_t) { return value; }
+  static Value box(Heap &, Value value) { return value; }
+};
+
+template <> struct NativeType<bool> {
+  static bool unbox(ObjNative *native, Value value, size_t position) {
+    bool const *boolean = std::get_if<bool>(&value);
+    if (boolean == nullptr) {
+      native->argumentError(position, "a boolean");
+    }
+    return *boolean;
+  }
+  static Value box(Heap &, bool value) { return value; }
+};
+
+template <typename T>
+struct NativeType<T, std::enable_if_t<std::is_arithmetic_v<T> &&
+                                      !std::is_same_v<T, bool>>> {
+  static T unbox(ObjNative *native, Value value, size_t position) {
+    if (int64_t const *integer = std::get_if<int64_t>(&value)) {
+      return static_cast<T>(*integer);
+    }
+    double const *number = std::get_if<double>(&value);
+    if (number == nullptr) {
+      native->argumentError(position, "a number");
+    }
+    return static_cast<T>(*number);
+  }
+  static Value box(Heap &, T value) {
+    if constexpr (std::is_integral_v<T> && sizeof(T) < sizeof(int64_t)) {
+      return static_cast<int64_t>(value);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      if (fitsInteger(value)) {
+        return static_cast<int64_t>(value);
+      }
+    } else if constexpr (std::is_integral_v<T>) {
+      if (value <= static_cast<uint64_t>(MAX_INTEGER)) {
+        return static_cast<int64_t>(value);
+      }
+    }
+    return static_cast<double>(value);
+  }
+};
+
+// Views the interned string, which lives as long as the heap.
+template <> struct NativeType<std::string_view> {
+  static std::string_view unbox(ObjNative *native, Value value,
+                                size_t position) {
+    if (!isString(value)) {
+      native->argumentError(position, "a string");
+    }
+    return asString(value)->chars;
+  }
+  static Value box(Heap &heap, std::string_view value) {
+    return heap.intern(value);
+  }
+};
+
+template <> struct NativeType<std::string> {
+  static std::string unbox(ObjNative *native, Value value, size_t position) {
+    return std::string{
+        NativeType<std::string_view>::unbox(native, value, position)};
+  }
+  static Value box(Heap &heap, std::string const &value) {
+    return heap.intern(value);
+  }
+};
+
+// Calls a bound function of type Function with unboxed arguments. Functions
+// that take Heap & or VM & first get the VM's heap or the VM itself ahead of
+// the script's arguments.
+template <typename Function, typename R, typename... Args, size_t... I>
+Value applyNative([[maybe_unused]] VM &vm, Heap &heap, ObjNative *native,
+                  [[maybe_unused]] Value *args, std::index_sequence<I...>) {
+  auto function = reinterpret_cast<Function>(native->function);
+  // Braced initialization converts the arguments left to right, so the
+  // first bad one is the one reported.
+  std::tuple<std::decay_t<Args>...> unboxed{
+      NativeType<std::decay_t<Args>>::unbox(native, args[I], I + 1)...};
+  auto call = [&]() -> R {
+    if constexpr (std::is_same_v<Function, R (*)(Heap &, Args...)>) {
+      return function(heap, std::get<I>(std::move(unboxed))...);
+    } else if constexpr (std::is_same_v<Function, R (*)(VM &, Args...)>) {
+      return function(vm, std::get<I>(std::move(unboxed))...);
+    } else {
+      return function(std::get<I>(std::move(unboxed))...);
+    }
+  };
+  if constexpr (std::is_void_v<R>) {
+    call();
+    return Nil{};
+  } else {
+    return NativeType<std::decay_t<R>>::box(heap, call());
+  }
+}
+
+// The thunks stored in an ObjNative for functions of these signatures. The
+// VM has already checked the argument count against the arity.
+template <typename R, typename... Args>
+Value callNative(VM &vm, Heap &heap, ObjNative *native, Value *args) {
+  return applyNative<R (*)(Args...), R, Args...>(
+      vm, heap, native, args, std::index_sequence_for<Args...>{});
+}
+
+template <typename R, typename... Args>
+Value callNativeWithHeap(VM &vm, Heap &heap, ObjNative *native, Value *args) {
+  return applyNative<R (*)(Heap &, Args...), R, Args...>(
+      vm, heap, native, args, std::index_sequence_for<Args...>{});
+}
+
+template <typename R, typename... Args>
+Value callNativeWithVM(VM &vm, Heap &heap, ObjNative *native, Value *args) {
+  return applyNative<R (*)(VM &, Args...), R, Args...>(
+      vm, heap, native, args, std::index_sequence_for<Args...>{});
+}
+
+} // namespace lox
+
+#endif
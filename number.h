@@ -0,0 +1,130 @@
+#ifndef cpplox_number_h
+#define cpplox_number_h
+
+#include <cstdint>
+#include <variant>
+
+#include "value.h"
+
+namespace lox {
+
+// Numbers are held either as doubles or as tagged integers. Integer
+// literals become integers, and arithmetic on two integers stays in the
+// integer domain, which spares counting loops and index math the
+// conversions. Integers are only a representation, never a separate type:
+// they are kept within +-2^53, where doubles are exact, and an operation
+// whose integer result would leave that range, or would be -0, produces
+// the double instead. So every result is the one double arithmetic gives.
+
+constexpr int64_t MAX_INTEGER = int64_t{1} << 53;
+
+inline bool fitsInteger(int64_t value) {
+  return value >= -MAX_INTEGER && value <= MAX_INTEGER;
+}
+
+inline bool isNumber(Value const &value) {
+  return std::holds_alternative<double>(value) ||
+         std::holds_alternative<int64_t>(value);
+}
+
+// The value of a number, which must be one, as a double.
+inline double asNumber(Value const &value) {
+  if (int64_t const *integer = std::get_if<int64_t>(&value)) {
+    return static_cast<double>(*integer);
+  }
+  return *std::get_if<double>(&value);
+}
+
+// Reads value as a double, returning false if it isn't a number.
+inline bool toDouble(Value const &value, double &number) {
+  if (double const *real = std::get_if<double>(&value)) {
+    number = *real;
+    return true;
+  }
+  if (int64_t const *integer = std::get_if<int64_t>(&value)) {
+    number = static_cast<double>(*integer);
+    return true;
+  }
+  return false;
+}
+
+enum class NumberOp { Add, Subtract, Multiply, Divide, Less, Greater };
+
+// Applies op to a and b; result may be either of them. Returns false,
+// leaving result alone, if either isn't a number.
+template <NumberOp op>
+inline bool numberOp(Value const &a, Value const &b, Value &result) {
+  int64_t const *x = std::get_if<int64_t>(&a);
+  int64_t const *y = std::get_if<int64_t>(&b);
+  if (x != nullptr && y != nullptr) {
+    int64_t integer;
+    if constexpr (op == NumberOp::Less) {
+      result.emplace<bool>(*x < *y);
+      return true;
+    } else if constexpr (op == NumberOp::Greater) {
+      result.emplace<bool>(*x > *y);
+      return true;
+    } else if constexpr (op == NumberOp::Add) {
+      integer = *x + *y;
+      if (fitsInteger(integer)) {
+        result.emplace<int64_t>(integer);
+        return true;
+      }
+    } else if constexpr (op == NumberOp::Subtract) {
+      integer = *x - *y;
+      if (fitsInteger(integer)) {
+        result.emplace<int64_t>(integer);
+        return true;
+      }
+    } else if constexpr (op == NumberOp::Multiply) {
+      // A zero product with a negative operand is -0.
+      if (!__builtin_mul_overflow(*x, *y, &integer) && fitsInteger(integer) &&
+          (integer != 0 || (*x >= 0 && *y >= 0))) {
+        result.emplace<int64_t>(integer);
+        return true;
+      }
+    }
+    // Division always produces a double.
+  }
+
+  double l, r;
+  if (!toDouble(a, l) || !toDouble(b, r)) {
+    return false;
+  }
+  if constexpr (op == NumberOp::Add) {
+    result.emplace<double>(l + r);
+  } else if constexpr (op == NumberOp::Subtract) {
+    result.emplace<double>(l - r);
+  } else if constexpr (op == NumberOp::Multiply) {
+    result.emplace<double>(l * r);
+  } else if constexpr (op == NumberOp::Divide) {
+    result.emplace<double>(l / r);
+  } else if constexpr (op == NumberOp::Less) {
+    result.emplace<bool>(l < r);
+  } else {
+    result.emplace<bool>(l > r);
+  }
+  return true;
+}
+
+// Negates a number, returning false if value isn't one.
+inline bool negateNumber(Value const &value, Value &result) {
+  if (int64_t const *integer = std::get_if<int64_t>(&value)) {
+    // The range is symmetric, so only zero needs a double.
+    if (*integer == 0) {
+      result.emplace<double>(-0.0);
+    } else {
+      result.emplace<int64_t>(-*integer);
+    }
+    return true;
+  }
+  if (double const *number = std::get_if<double>(&value)) {
+    result.emplace<double>(-*number);
+    return true;
+  }
+  return false;
+}
+
+} // namespace lox
+
+#endif
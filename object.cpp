@@ -0,0 +1,115 @@
+#include "object.h"
+
+#include <stdexcept>
+
+namespace lox {
+
+void ObjNative::argumentError(size_t position, char const *expected) {
+  throw std::runtime_error("Argument " + std::to_string(position) + " to '" +
+                           std::string{name->chars} + "' must be " +
+                           expected + ".");
+}
+
+ObjString *Heap::intern(std::string_view chars) {
+  auto found = strings.find(chars);
+  if (found != strings.end()) {
+    return found->second;
+  }
+
+  ObjString *string = allocate<ObjString>(chars);
+  strings.emplace(string->chars, string);
+  return string;
+}
+
+void Heap::freeObject(Object *object) {
+  switch (object->type) {
+  case ObjType::Array:
+    destroy<ObjArray>(object);
+    break;
+  case ObjType::BoundMethod:
+    destroy<ObjBoundMethod>(object);
+    break;
+  case ObjType::Channel:
+    destroy<ObjChannel>(object);
+    break;
+  case ObjType::Class:
+    destroy<ObjClass>(object);
+    break;
+  case ObjType::Function:
+    destroy<ObjFunction>(object);
+    break;
+  case ObjType::Instance:
+    destroy<ObjInstance>(object);
+    break;
+  case ObjType::Map:
+    destroy<ObjMap>(object);
+    break;
+  case ObjType::Native:
+    destroy<ObjNative>(object);
+    break;
+  case ObjType::String:
+    destroy<ObjString>(object);
+    break;
+  }
+}
+
+void Heap::freeObjects() {
+  strings.clear();
+  while (objects != nullptr) {
+    Object *next = objects->next;
+    freeObject(objects);
+    objects = next;
+  }
+}
+
+void printObject(OutputSink &out, Object *object) {
+  switch (object->type) {
+  case ObjType::Array: {
+    auto array = static_cast<ObjArray *>(object);
+    out.put('[');
+    for (size_t i = 0; i < array->length; i++) {
+      if (i != 0) {
+        out.write(", ");
+      }
+      printValue(out, array->data[i]);
+    }
+    out.put(']');
+    break;
+  }
+  case ObjType::BoundMethod:
+    printObject(out, static_cast<ObjBoundMethod *>(object)->method);
+    break;
+  case ObjType::Channel:
+    out.write("<channel>");
+    break;
+  case ObjType::Class:
+    out.write(static_cast<ObjClass *>(object)->name->chars);
+    break;
+  case ObjType::Instance:
+    out.write(static_cast<ObjInstance *>(object)->klass->name->chars);
+    out.write(" instance");
+    break;
+  case ObjType::Map:
+    out.write("<map>");
+    break;
+  case ObjType::Native:
+    out.write("<native fn>");
+    break;
+  case ObjType::String:
+    out.write(static_cast<ObjString *>(object)->chars);
+    break;
+  case ObjType::Function: {
+    auto function = static_cast<ObjFunction *>(object);
+    if (function->name.empty()) {
+      out.write("<script>");
+    } else {
+      out.write("<fn ");
+      out.write(function->name);
+      out.put('>');
+    }
+    break;
+  }
+  }
+}
+
+} // namespace lox
@@ -0,0 +1,308 @@
+#ifndef cpplox_object_h
+#define cpplox_object_h
+
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "chunk.h"
+#include "shape.h"
+#include "table.h"
+#include "value.h"
+
+namespace lox {
+
+enum class ObjType {
+  Array,
+  BoundMethod,
+  Channel,
+  Class,
+  Function,
+  Instance,
+  Map,
+  Native,
+  String,
+};
+
+class Object {
+public:
+  explicit Object(ObjType type) : type{type} {}
+  virtual ~Object() = default;
+
+  ObjType type;
+  Object *next = nullptr;
+};
+
+class AotRuntime;
+struct LazyBody;
+class ObjFunction;
+// A function's body translated to C++ by --emit-cpp; see aot.h.
+using CompiledFn = Value (*)(AotRuntime &runtime, ObjFunction *function,
+                             Value *slots);
+
+class ObjFunction : public Object {
+public:
+  explicit ObjFunction(std::pmr::memory_resource *memory)
+      : Object{ObjType::Function}, chunk{memory}, name{memory} {}
+
+  int arity = 0;
+  Chunk chunk;
+  std::pmr::string name;
+  // Set only when running an ahead-of-time compiled script.
+  CompiledFn compiled = nullptr;
+  // Set until the body of a lazily compiled function is first called; see
+  // lazy.h.
+  std::shared_ptr<LazyBody> lazy;
+};
+
+class ObjString : public Object {
+public:
+  ObjString(std::pmr::memory_resource *memory, std::string_view chars)
+      : Object{ObjType::String}, chars{chars, memory} {}
+
+  std::pmr::string chars;
+};
+
+class ObjClass : public Object {
+public:
+  ObjClass(std::pmr::memory_resource *memory, ObjString *name)
+      : Object{ObjType::Class}, name{name}, methods{memory},
+        rootShape{memory} {}
+
+  ObjString *name;
+  std::pmr::unordered_map<ObjString *, ObjFunction *> methods;
+  ObjFunction *initializer = nullptr;
+  // Every instance of the class starts out with this empty shape, so shapes
+  // are never shared between classes and also identify the class.
+  Shape rootShape;
+};
+
+class ObjInstance : public Object {
+public:
+  ObjInstance(std::pmr::memory_resource *memory, ObjClass *klass)
+      : Object{ObjType::Instance}, klass{klass}, shape{&klass->rootShape},
+        fields{memory} {}
+
+  ObjClass *klass;
+  Shape *shape;
+  std::pmr::vector<Value> fields;
+};
+
+// A fixed-length, contiguous array of numbers. A slice owns no elements: it
+// views a range of its base array's, so writes through either are seen by
+// both. A frozen array can't be written; its elements live outside the heap
+// in a buffer that arrays in other VMs can share.
+class ObjArray : public Object {
+public:
+  ObjArray(std::pmr::memory_resource *memory, size_t length, double fill)
+      : Object{ObjType::Array}, elements(length, fill, memory),
+        data{elements.data()}, length{length} {}
+  ObjArray(std::pmr::memory_resource *memory, ObjArray *array, size_t start,
+           size_t length)
+      : Object{ObjType::Array}, elements{memory},
+        base{array->base != nullptr ? array->base : array},
+        offset{array->offset + start}, data{array->data + start},
+        length{length} {}
+  ObjArray(std::pmr::memory_resource *memory, std::shared_ptr<double[]> frozen,
+           double *data, size_t length)
+      : Object{ObjType::Array}, elements{memory}, frozen{std::move(frozen)},
+        data{data}, length{length} {}
+
+  bool isFrozen() const {
+    return (base != nullptr ? base : this)->frozen != nullptr;
+  }
+
+  std::pmr::vector<double> elements;
+  // For slices, the array owning the elements and where the slice starts.
+  ObjArray *base = nullptr;
+  size_t offset = 0;
+  // Holds the elements of a frozen array, which data points into.
+  std::shared_ptr<double[]> frozen;
+  double *data;
+  size_t length;
+};
+
+class Channel;
+
+// A script's handle on a channel, which may also be reachable from other
+// VMs; see channel.h.
+class ObjChannel : public Object {
+public:
+  explicit ObjChannel(std::shared_ptr<Channel> channel)
+      : Object{ObjType::Channel}, channel{std::move(channel)} {}
+
+  std::shared_ptr<Channel> channel;
+};
+
+// A hash map from any values to any values; see table.h.
+class ObjMap : public Object {
+public:
+  explicit ObjMap(std::pmr::memory_resource *memory)
+      : Object{ObjType::Map}, table{memory} {}
+
+  Table table;
+};
+
+class ObjBoundMethod : public Object {
+public:
+  ObjBoundMethod(Value receiver, ObjFunction *method)
+      : Object{ObjType::BoundMethod}, receiver{receiver}, method{method} {}
+
+  Value receiver;
+  ObjFunction *method;
+};
+
+class Heap;
+class ObjNative;
+class VM;
+// Unboxes the arguments, calls the bound C++ function and boxes its result.
+// Generated from the function's signature; see native.h.
+using NativeThunk = Value (*)(VM &vm, Heap &heap, ObjNative *native,
+                              Value *args);
+
+// A C++ function bound with VM::defineNative. Calls to it run the thunk
+// straight off the caller's stack without pushing a frame.
+class ObjNative : public Object {
+public:
+  ObjNative(ObjString *name, int arity, NativeThunk thunk, void (*function)())
+      : Object{ObjType::Native}, name{name}, arity{arity}, thunk{thunk},
+        function{function} {}
+
+  [[noreturn]] void argumentError(size_t position, char const *expected);
+
+  ObjString *name;
+  int arity;
+  NativeThunk thunk;
+  // The bound function, cast back to its real type by the thunk.
+  void (*function)();
+};
+
+inline bool isObjType(Value value, ObjType type) {
+  Object *const *object = std::get_if<Object *>(&value);
+  return object != nullptr && (*object)->type == type;
+}
+
+inline bool isFunction(Value value) {
+  return isObjType(value, ObjType::Function);
+}
+
+inline ObjFunction *asFunction(Value value) {
+  return static_cast<ObjFunction *>(std::get<Object *>(value));
+}
+
+inline bool isString(Value value) { return isObjType(value, ObjType::String); }
+
+inline ObjString *asString(Value value) {
+  return static_cast<ObjString *>(std::get<Object *>(value));
+}
+
+inline bool isClass(Value value) { return isObjType(value, ObjType::Class); }
+
+inline ObjClass *asClass(Value value) {
+  return static_cast<ObjClass *>(std::get<Object *>(value));
+}
+
+inline bool isInstance(Value value) {
+  return isObjType(value, ObjType::Instance);
+}
+
+inline ObjInstance *asInstance(Value value) {
+  return static_cast<ObjInstance *>(std::get<Object *>(value));
+}
+
+inline bool isNative(Value value) { return isObjType(value, ObjType::Native); }
+
+inline ObjNative *asNative(Value value) {
+  return static_cast<ObjNative *>(std::get<Object *>(value));
+}
+
+inline bool isArray(Value value) { return isObjType(value, ObjType::Array); }
+
+inline ObjArray *asArray(Value value) {
+  return static_cast<ObjArray *>(std::get<Object *>(value));
+}
+
+inline bool isChannel(Value value) {
+  return isObjType(value, ObjType::Channel);
+}
+
+inline ObjChannel *asChannel(Value value) {
+  return static_cast<ObjChannel *>(std::get<Object *>(value));
+}
+
+inline bool isMap(Value value) { return isObjType(value, ObjType::Map); }
+
+inline ObjMap *asMap(Value value) {
+  return static_cast<ObjMap *>(std::get<Object *>(value));
+}
+
+inline bool isBoundMethod(Value value) {
+  return isObjType(value, ObjType::BoundMethod);
+}
+
+inline ObjBoundMethod *asBoundMethod(Value value) {
+  return static_cast<ObjBoundMethod *>(std::get<Object *>(value));
+}
+
+// Owns every object created by the compiler or the VM. Objects are threaded
+// through an intrusive list and released together when the heap goes away.
+// Objects, and whatever storage they own, are carved out of the heap's
+// memory resource.
+class Heap {
+public:
+  explicit Heap(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : memory{memory}, strings{memory} {}
+  Heap(Heap const &) = delete;
+  Heap &operator=(Heap const &) = delete;
+  ~Heap() { freeObjects(); }
+
+  template <typename T, typename... Args> T *allocate(Args &&...args) {
+    void *storage = memory->allocate(sizeof(T), alignof(T));
+    T *object;
+    try {
+      if constexpr (std::is_constructible_v<T, std::pmr::memory_resource *,
+                                            Args...>) {
+        object = new (storage) T(memory, std::forward<Args>(args)...);
+      } else {
+        object = new (storage) T(std::forward<Args>(args)...);
+      }
+    } catch (...) {
+      memory->deallocate(storage, sizeof(T), alignof(T));
+      throw;
+    }
+    object->next = objects;
+    objects = object;
+    return object;
+  }
+
+  // Returns the unique string object with these characters, so strings can
+  // be compared and hashed by pointer.
+  ObjString *intern(std::string_view chars);
+  // The newest object; older ones follow through Object::next.
+  Object *head() const { return objects; }
+  void freeObjects();
+
+private:
+  std::pmr::memory_resource *memory;
+  Object *objects = nullptr;
+  // Keys view the characters of the string objects themselves.
+  std::pmr::unordered_map<std::string_view, ObjString *> strings;
+
+  template <typename T> void destroy(Object *object) {
+    static_cast<T *>(object)->~T();
+    memory->deallocate(object, sizeof(T), alignof(T));
+  }
+  void freeObject(Object *object);
+};
+
+void printObject(OutputSink &out, Object *object);
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,331 @@
+#include "optimizer.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace lox {
+
+namespace {
+
+constexpr size_t NONE = SIZE_MAX;
+
+bool isJump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP;
+}
+
+struct Instruction {
+  // Where the instruction starts in the original code.
+  size_t offset;
+  uint8_t op;
+  size_t line;
+  // For jumps, the index of the instruction they land on. Jumps to a removed
+  // instruction land on the next live one.
+  size_t target = NONE;
+  // For loops, the index of their LoopSite.
+  size_t site = NONE;
+  bool live = true;
+};
+
+class JumpOptimizer {
+public:
+  explicit JumpOptimizer(Chunk &chunk) : chunk{chunk} {}
+
+  void run() {
+    if (!decode()) {
+      return;
+    }
+
+    // Each rewrite can expose another, so repeat until nothing changes.
+    bool changed = true;
+    while (changed) {
+      changed = threadJumps();
+      changed |= foldConditions();
+      changed |= dropNoopJumps();
+      changed |= removeUnreachable();
+    }
+    encode();
+  }
+
+private:
+  Chunk &chunk;
+  std::vector<Instruction> code;
+
+  bool decode();
+  void encode();
+  bool threadJumps();
+  bool foldConditions();
+  bool dropNoopJumps();
+  bool removeUnreachable();
+
+  // The first live instruction at or after index.
+  size_t resolve(size_t index) const {
+    while (index < code.size() && !code[index].live) {
+      index++;
+    }
+    return index;
+  }
+
+  size_t next(size_t index) const { return resolve(index + 1); }
+
+  size_t previous(size_t index) const {
+    while (index-- > 0) {
+      if (code[index].live) {
+        return index;
+      }
+    }
+    return NONE;
+  }
+
+  std::vector<bool> jumpTargets() const {
+    std::vector<bool> targeted(code.size() + 1, false);
+    for (Instruction const &instruction : code) {
+      if (instruction.live && isJump(instruction.op)) {
+        targeted[resolve(instruction.target)] = true;
+      }
+    }
+    return targeted;
+  }
+};
+
+bool JumpOptimizer::decode() {
+  std::vector<size_t> indexAt(chunk.codes.size() + 1, NONE);
+  size_t run = 0;
+  size_t runEnd = 0;
+  size_t line = 0;
+
+  for (size_t offset = 0; offset < chunk.codes.size();) {
+    while (offset >= runEnd && run < chunk.lines.size()) {
+      runEnd += chunk.lines[run];
+      line = chunk.lines[run + 1];
+      run += 2;
+    }
+
+    uint8_t op = chunk.codes[offset];
+    indexAt[offset] = code.size();
+    code.push_back(Instruction{offset, op, line});
+    offset += instructionLength(op);
+  }
+
+  for (Instruction &instruction : code) {
+    if (!isJump(instruction.op)) {
+      continue;
+    }
+
+    size_t offset = instruction.offset;
+    size_t end = offset + instructionLength(instruction.op);
+    if (end > chunk.codes.size()) {
+      return false;
+    }
+    size_t distance = (chunk.codes[offset + 1] << 8) | chunk.codes[offset + 2];
+    size_t target = end + distance;
+    if (instruction.op == OP_LOOP) {
+      target = end - distance;
+      instruction.site =
+          (chunk.codes[offset + 3] << 8) | chunk.codes[offset + 4];
+    }
+    if (target >= chunk.codes.size() || indexAt[target] == NONE) {
+      return false;
+    }
+    instruction.target = indexAt[target];
+  }
+  return true;
+}
+
+// Points jumps that land on an unconditional jump at that jump's target. A
+// conditional jump landing on another conditional jump tests the same value
+// again, so it can skip straight to the second one's target too.
+bool JumpOptimizer::threadJumps() {
+  bool changed = false;
+  for (size_t i = 0; i < code.size(); i++) {
+    Instruction &jump = code[i];
+    if (!jump.live || !isJump(jump.op)) {
+      continue;
+    }
+
+    size_t target = resolve(jump.target);
+    // Bounded so that a cycle such as an empty infinite loop terminates.
+    for (size_t steps = 0; steps < code.size() && target < code.size();
+         steps++) {
+      Instruction const &landing = code[target];
+      bool unconditional = landing.op == OP_JUMP || landing.op == OP_LOOP;
+      bool sameTest = jump.op == OP_JUMP_IF_FALSE &&
+                      landing.op == OP_JUMP_IF_FALSE;
+      if (!unconditional && !sameTest) {
+        break;
+      }
+
+      size_t further = resolve(landing.target);
+      // Conditional jumps only go forwards.
+      if (further == target ||
+          (jump.op == OP_JUMP_IF_FALSE && further <= i)) {
+        break;
+      }
+      target = further;
+    }
+
+    if (target != jump.target) {
+      jump.target = target;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// A conditional jump right after a literal always goes the same way. Taken
+// jumps become unconditional; jumps never taken disappear, and with them
+// the literal and the pop that discards it when nothing else needs them.
+bool JumpOptimizer::foldConditions() {
+  bool changed = false;
+  std::vector<bool> targeted = jumpTargets();
+  for (size_t i = 0; i < code.size(); i++) {
+    Instruction &jump = code[i];
+    if (!jump.live || jump.op != OP_JUMP_IF_FALSE || targeted[i]) {
+      continue;
+    }
+
+    size_t before = previous(i);
+    if (before == NONE) {
+      continue;
+    }
+    Instruction &condition = code[before];
+
+    // Constants are numbers, strings and functions, which are all truthy.
+    if (condition.op == OP_TRUE || condition.op == OP_CONSTANT) {
+      jump.live = false;
+      size_t after = next(i);
+      if (after < code.size() && code[after].op == OP_POP &&
+          !targeted[after]) {
+        condition.live = false;
+        code[after].live = false;
+      }
+    } else if (condition.op == OP_FALSE || condition.op == OP_NIL) {
+      jump.op = OP_JUMP;
+      size_t target = resolve(jump.target);
+      if (target < code.size() && code[target].op == OP_POP) {
+        condition.live = false;
+        jump.target = next(target);
+      }
+    } else {
+      continue;
+    }
+
+    // Removing or retargeting code moves where other jumps land.
+    targeted = jumpTargets();
+    changed = true;
+  }
+  return changed;
+}
+
+bool JumpOptimizer::dropNoopJumps() {
+  bool changed = false;
+  for (size_t i = 0; i < code.size(); i++) {
+    Instruction &jump = code[i];
+    if (jump.live && isJump(jump.op) && resolve(jump.target) == next(i)) {
+      jump.live = false;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool JumpOptimizer::removeUnreachable() {
+  std::vector<bool> reached(code.size(), false);
+  std::vector<size_t> worklist{resolve(0)};
+  while (!worklist.empty()) {
+    size_t i = worklist.back();
+    worklist.pop_back();
+    if (i >= code.size() || reached[i]) {
+      continue;
+    }
+    reached[i] = true;
+
+    Instruction const &instruction = code[i];
+    if (isJump(instruction.op)) {
+      worklist.push_back(resolve(instruction.target));
+    }
+    if (instruction.op != OP_JUMP && instruction.op != OP_LOOP &&
+        instruction.op != OP_RETURN) {
+      worklist.push_back(next(i));
+    }
+  }
+
+  bool changed = false;
+  for (size_t i = 0; i < code.size(); i++) {
+    if (code[i].live && !reached[i]) {
+      code[i].live = false;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void JumpOptimizer::encode() {
+  // Threading can turn a forward jump backwards and vice versa, so settle
+  // the direction, and with it the length, of every unconditional jump
+  // first. A jump that becomes a loop needs a loop site of its own.
+  size_t loopCount = chunk.loops.size();
+  for (size_t i = 0; i < code.size(); i++) {
+    Instruction &jump = code[i];
+    if (!jump.live || (jump.op != OP_JUMP && jump.op != OP_LOOP)) {
+      continue;
+    }
+    jump.op = jump.target <= i ? OP_LOOP : OP_JUMP;
+    if (jump.op == OP_LOOP && jump.site == NONE) {
+      jump.site = loopCount++;
+    }
+  }
+
+  // A removed instruction takes no space, so its new offset is that of the
+  // next live one, which is exactly where jumps to it should land.
+  std::vector<size_t> newOffsets(code.size() + 1);
+  size_t offset = 0;
+  for (size_t i = 0; i < code.size(); i++) {
+    newOffsets[i] = offset;
+    if (code[i].live) {
+      offset += instructionLength(code[i].op);
+    }
+  }
+  newOffsets[code.size()] = offset;
+
+  // Leave the chunk as compiled if some jump could no longer be encoded.
+  if (offset > UINT16_MAX || loopCount > UINT16_MAX + 1) {
+    return;
+  }
+
+  std::vector<uint8_t> original(chunk.codes.begin(), chunk.codes.end());
+  chunk.codes.clear();
+  chunk.lines.clear();
+  chunk.loops.resize(loopCount);
+
+  for (size_t i = 0; i < code.size(); i++) {
+    Instruction const &instruction = code[i];
+    if (!instruction.live) {
+      continue;
+    }
+
+    if (!isJump(instruction.op)) {
+      size_t length = instructionLength(instruction.op);
+      for (size_t j = 0; j < length; j++) {
+        chunk.write(original[instruction.offset + j], instruction.line);
+      }
+      continue;
+    }
+
+    size_t from = newOffsets[i] + instructionLength(instruction.op);
+    size_t to = newOffsets[instruction.target];
+    size_t distance = instruction.op == OP_LOOP ? from - to : to - from;
+    chunk.write(instruction.op, instruction.line);
+    chunk.write((distance >> 8) & 0xff, instruction.line);
+    chunk.write(distance & 0xff, instruction.line);
+    if (instruction.op == OP_LOOP) {
+      chunk.write((instruction.site >> 8) & 0xff, instruction.line);
+      chunk.write(instruction.site & 0xff, instruction.line);
+    }
+  }
+}
+
+} // namespace
+
+void optimizeJumps(Chunk &chunk) { JumpOptimizer{chunk}.run(); }
+
+} // namespace lox
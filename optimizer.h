@@ -0,0 +1,17 @@
+#ifndef cpplox_optimizer_h
+#define cpplox_optimizer_h
+
+#include "chunk.h"
+
+namespace lox {
+
+// Cleans up the control flow the single-pass compiler leaves behind. Jumps
+// that land on other jumps are pointed at the final target, conditional
+// jumps on a constant condition become unconditional or disappear, jumps to
+// the next instruction are dropped, and instructions no path reaches are
+// removed. Runs on a finished chunk before it is verified.
+void optimizeJumps(Chunk &chunk);
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,144 @@
+#include "output.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <unistd.h>
+#include <utility>
+
+namespace lox {
+
+OutputSink::OutputSink(int fd) : fd{fd}, buffer{new char[BUFFER_SIZE]} {}
+
+OutputSink OutputSink::memory() { return OutputSink{MEMORY}; }
+
+OutputSink::OutputSink(OutputSink &&other) noexcept
+    : fd{other.fd}, lineBuffered{other.lineBuffered}, used{other.used},
+      buffer{std::move(other.buffer)},
+      memoryContents{std::move(other.memoryContents)} {
+  other.used = 0;
+}
+
+OutputSink &OutputSink::operator=(OutputSink &&other) noexcept {
+  if (this != &other) {
+    flush();
+    fd = other.fd;
+    lineBuffered = other.lineBuffered;
+    used = std::exchange(other.used, 0);
+    buffer = std::move(other.buffer);
+    memoryContents = std::move(other.memoryContents);
+  }
+  return *this;
+}
+
+OutputSink::~OutputSink() { flush(); }
+
+void OutputSink::writeNumber(double value) {
+  if (BUFFER_SIZE - used < 32) {
+    flush();
+  }
+
+  char *start = buffer.get() + used;
+  char *end = buffer.get() + BUFFER_SIZE;
+  // Whole numbers a double holds exactly print in full, so counters read
+  // 100000 rather than 1e+05.
+  auto result = std::abs(value) <= 9007199254740992.0 &&
+                        value == std::trunc(value)
+                    ? std::to_chars(start, end, value,
+                                    std::chars_format::fixed)
+                    : std::to_chars(start, end, value);
+  used += result.ptr - start;
+}
+
+void OutputSink::writeInteger(int64_t value) {
+  if (BUFFER_SIZE - used < 32) {
+    flush();
+  }
+
+  char *start = buffer.get() + used;
+  auto result = std::to_chars(start, buffer.get() + BUFFER_SIZE, value);
+  used += result.ptr - start;
+}
+
+void OutputSink::format(char const *fmt, ...) {
+  char text[256];
+  va_list args;
+  va_start(args, fmt);
+  int length = std::vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+
+  if (length > 0) {
+    size_t size = static_cast<size_t>(length);
+    write(std::string_view{text, size < sizeof(text) ? size : sizeof(text) - 1});
+  }
+}
+
+void OutputSink::flush() {
+  if (used == 0 || buffer == nullptr) {
+    return;
+  }
+
+  if (fd == MEMORY) {
+    memoryContents.append(buffer.get(), used);
+    used = 0;
+    return;
+  }
+
+  char const *data = buffer.get();
+  size_t remaining = used;
+  while (remaining > 0) {
+    ssize_t written = ::write(fd, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    data += written;
+    remaining -= written;
+  }
+  used = 0;
+}
+
+std::string const &OutputSink::contents() {
+  flush();
+  return memoryContents;
+}
+
+void OutputSink::clear() {
+  used = 0;
+  memoryContents.clear();
+}
+
+void OutputSink::writeSlow(std::string_view text) {
+  flush();
+  if (text.size() <= BUFFER_SIZE) {
+    std::memcpy(buffer.get(), text.data(), text.size());
+    used = text.size();
+    if (lineBuffered &&
+        std::memchr(text.data(), '\n', text.size()) != nullptr) {
+      flush();
+    }
+    return;
+  }
+
+  // Larger than the whole buffer: hand it straight to the destination.
+  if (fd == MEMORY) {
+    memoryContents.append(text);
+    return;
+  }
+  while (!text.empty()) {
+    ssize_t written = ::write(fd, text.data(), text.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    text.remove_prefix(written);
+  }
+}
+
+} // namespace lox
@@ -0,0 +1,83 @@
+#ifndef cpplox_output_h
+#define cpplox_output_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace lox {
+
+// Buffered destination for everything a VM prints. Output accumulates in a
+// fixed buffer and reaches the file descriptor (or, for memory sinks, the
+// contents() string) when the buffer fills or flush() is called, and at the
+// end of every line once setLineBuffered(true) is.
+class OutputSink {
+public:
+  static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+  // Writes to the given file descriptor, standard output by default.
+  explicit OutputSink(int fd = 1);
+  // Collects output in memory, for embedding and tests.
+  static OutputSink memory();
+
+  OutputSink(OutputSink &&other) noexcept;
+  OutputSink &operator=(OutputSink &&other) noexcept;
+  ~OutputSink();
+
+  void write(std::string_view text) {
+    if (text.size() > BUFFER_SIZE - used) {
+      return writeSlow(text);
+    }
+    std::memcpy(buffer.get() + used, text.data(), text.size());
+    used += text.size();
+    if (lineBuffered &&
+        std::memchr(text.data(), '\n', text.size()) != nullptr) {
+      flush();
+    }
+  }
+
+  void put(char c) {
+    if (used == BUFFER_SIZE) {
+      flush();
+    }
+    buffer[used++] = c;
+    if (c == '\n' && lineBuffered) {
+      flush();
+    }
+  }
+
+  // Whole numbers up to 2^53 in full; anything else in the shortest
+  // representation that reads back as the same double.
+  void writeNumber(double value);
+  void writeInteger(int64_t value);
+  void format(char const *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  void flush();
+  // For output someone is watching as it's produced, at the cost of a
+  // write per line.
+  void setLineBuffered(bool lineBuffered) {
+    this->lineBuffered = lineBuffered;
+  }
+
+  // Everything written so far to a memory sink.
+  std::string const &contents();
+  void clear();
+
+private:
+  static constexpr int MEMORY = -1;
+
+  int fd;
+  bool lineBuffered = false;
+  size_t used = 0;
+  std::unique_ptr<char[]> buffer;
+  std::string memoryContents;
+
+  void writeSlow(std::string_view text);
+};
+
+} // namespace lox
+
+#endif
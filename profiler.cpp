@@ -0,0 +1,152 @@
+#include "profiler.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <string>
+#include <sys/time.h>
+
+#include "object.h"
+#include "vm.h"
+
+namespace lox {
+
+namespace {
+Profiler *volatile activeProfiler = nullptr;
+
+uint64_t mix(uint64_t hash, uint64_t value) {
+  hash ^= value;
+  hash *= 0x100000001b3ULL;
+  return hash;
+}
+} // namespace
+
+Profiler::Profiler(VM &vm, long intervalMicros)
+    : vm{vm}, intervalMicros{intervalMicros}, table(TABLE_SIZE) {}
+
+Profiler::~Profiler() { stop(); }
+
+void Profiler::start() {
+  if (running) {
+    return;
+  }
+
+  activeProfiler = this;
+
+  struct sigaction action {};
+  action.sa_handler = &Profiler::handleSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  itimerval timer{};
+  timer.it_interval.tv_sec = intervalMicros / 1000000;
+  timer.it_interval.tv_usec = intervalMicros % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  running = true;
+}
+
+void Profiler::stop() {
+  if (!running) {
+    return;
+  }
+
+  itimerval timer{};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  signal(SIGPROF, SIG_IGN);
+  activeProfiler = nullptr;
+  running = false;
+}
+
+void Profiler::handleSignal(int) {
+  Profiler *profiler = activeProfiler;
+  if (profiler != nullptr) {
+    profiler->sample();
+  }
+}
+
+// Runs inside the signal handler: only reads VM state and writes into the
+// preallocated table.
+void Profiler::sample() {
+  size_t frameCount = vm.frameCount;
+  // Pairs with the fences in VM::call, tail calls and returns: frames
+  // below the count read here are completely written.
+  std::atomic_signal_fence(std::memory_order_acquire);
+  if (frameCount == 0 || frameCount > vm.frames.size()) {
+    return;
+  }
+
+  Stack current;
+  current.truncated = frameCount > MAX_DEPTH;
+  current.depth = current.truncated ? MAX_DEPTH : frameCount;
+  current.hash = 0xcbf29ce484222325ULL;
+
+  // Keep the innermost frames when the stack is too deep to record whole.
+  size_t first = frameCount - current.depth;
+  for (uint32_t i = 0; i < current.depth; i++) {
+    CallFrame const &frame = vm.frames[first + i];
+    if (frame.function == nullptr) {
+      return;
+    }
+    uint8_t const *ip = first + i == frameCount - 1 ? vm.ip : frame.ip;
+    uint8_t const *code = frame.function->chunk.codes.data();
+
+    current.frames[i].function = frame.function;
+    current.frames[i].offset = ip > code ? ip - code - 1 : 0;
+    current.hash =
+        mix(current.hash, reinterpret_cast<uintptr_t>(frame.function));
+    current.hash = mix(current.hash, current.frames[i].offset);
+  }
+
+  for (size_t probe = 0; probe < TABLE_SIZE; probe++) {
+    Stack &slot = table[(current.hash + probe) & (TABLE_SIZE - 1)];
+    if (slot.count == 0) {
+      std::memcpy(&slot, &current, sizeof(Stack));
+      slot.count = 1;
+      samples = samples + 1;
+      return;
+    }
+
+    if (slot.hash == current.hash && slot.depth == current.depth &&
+        std::memcmp(slot.frames, current.frames,
+                    current.depth * sizeof(Frame)) == 0) {
+      slot.count++;
+      samples = samples + 1;
+      return;
+    }
+  }
+
+  dropped = dropped + 1;
+}
+
+void Profiler::writeFolded(std::ostream &out) const {
+  std::map<std::string, size_t> folded;
+
+  for (Stack const &stack : table) {
+    if (stack.count == 0) {
+      continue;
+    }
+
+    std::string key = stack.truncated ? "[truncated]" : "";
+    for (uint32_t i = 0; i < stack.depth; i++) {
+      Frame const &frame = stack.frames[i];
+      Chunk &chunk = frame.function->chunk;
+      if (!key.empty()) {
+        key += ';';
+      }
+      key += frame.function->name.empty() ? "<script>" : frame.function->name;
+      if (frame.offset < chunk.codes.size()) {
+        key += ':' + std::to_string(chunk.getLine(frame.offset));
+      }
+    }
+    folded[key] += stack.count;
+  }
+
+  for (auto const &[stack, count] : folded) {
+    out << stack << ' ' << count << '\n';
+  }
+}
+
+} // namespace lox
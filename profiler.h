@@ -0,0 +1,64 @@
+#ifndef cpplox_profiler_h
+#define cpplox_profiler_h
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace lox {
+class ObjFunction;
+class VM;
+
+// Statistical profiler driven by SIGPROF. The signal handler walks the VM's
+// call frames and counts the stack in a preallocated open-addressing table,
+// so sampling never allocates or takes locks. Samples are mapped to source
+// lines only when the folded-stack report is written.
+class Profiler {
+public:
+  static constexpr size_t MAX_DEPTH = 32;
+  static constexpr size_t TABLE_SIZE = 2048;
+
+  explicit Profiler(VM &vm, long intervalMicros = 1000);
+  Profiler(Profiler const &) = delete;
+  Profiler &operator=(Profiler const &) = delete;
+  ~Profiler();
+
+  void start();
+  void stop();
+
+  // Writes one "frame;frame;frame count" line per distinct stack, the
+  // format consumed by flamegraph.pl and compatible tools.
+  void writeFolded(std::ostream &out) const;
+
+  size_t sampleCount() const { return samples; }
+  size_t droppedCount() const { return dropped; }
+
+private:
+  struct Frame {
+    ObjFunction *function;
+    uint32_t offset;
+  };
+
+  struct Stack {
+    uint64_t hash;
+    size_t count;
+    uint32_t depth;
+    bool truncated;
+    Frame frames[MAX_DEPTH];
+  };
+
+  VM &vm;
+  long intervalMicros;
+  bool running = false;
+  std::vector<Stack> table;
+  volatile size_t samples = 0;
+  volatile size_t dropped = 0;
+
+  static void handleSignal(int);
+  void sample();
+};
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef cpplox_scan_simd_h
+#define cpplox_scan_simd_h
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Byte-class scanning kernels for the scanner's hot loops. Each function
+// returns the length of the run starting at p, so callers skip a whole run in
+// one step. They read whole blocks past the end of the run and rely on the
+// source being followed by SCAN_PADDING NUL bytes, which also stop every run.
+namespace lox::simd {
+
+constexpr size_t SCAN_PADDING = 64;
+
+#if defined(__AVX2__)
+
+using Block = __m256i;
+constexpr size_t BLOCK_SIZE = 32;
+
+inline Block load(char const *p) {
+  return _mm256_loadu_si256(reinterpret_cast<Block const *>(p));
+}
+inline Block eq(Block b, char c) {
+  return _mm256_cmpeq_epi8(b, _mm256_set1_epi8(c));
+}
+// lo <= b <= hi, for ASCII ranges; bytes >= 0x80 compare as negative.
+inline Block range(Block b, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(b, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), b));
+}
+inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+inline uint32_t mask(Block b) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(b));
+}
+constexpr uint32_t FULL_MASK = 0xffffffffu;
+
+#elif defined(__SSE2__)
+
+using Block = __m128i;
+constexpr size_t BLOCK_SIZE = 16;
+
+inline Block load(char const *p) {
+  return _mm_loadu_si128(reinterpret_cast<Block const *>(p));
+}
+inline Block eq(Block b, char c) {
+  return _mm_cmpeq_epi8(b, _mm_set1_epi8(c));
+}
+inline Block range(Block b, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(b, _mm_set1_epi8(lo - 1)),
+                       _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), b));
+}
+inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+inline uint32_t mask(Block b) {
+  return static_cast<uint32_t>(_mm_movemask_epi8(b));
+}
+constexpr uint32_t FULL_MASK = 0xffffu;
+
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// Length of the run of bytes for which inRun(block) is set (or, with Until,
+// clear). Newlines inside the run are added to *lines when it is non-null.
+template <bool Until, typename Classify>
+inline size_t runLength(char const *p, Classify inRun, int *lines) {
+  for (size_t i = 0;; i += BLOCK_SIZE) {
+    Block b = load(p + i);
+    uint32_t stop = mask(inRun(b));
+    if (!Until) {
+      stop = ~stop & FULL_MASK;
+    }
+    uint32_t newlines = lines != nullptr ? mask(eq(b, '\n')) : 0;
+    if (stop != 0) {
+      unsigned n = __builtin_ctz(stop);
+      newlines &= (1u << n) - 1;
+      if (newlines != 0) {
+        *lines += __builtin_popcount(newlines);
+      }
+      return i + n;
+    }
+    if (newlines != 0) {
+      *lines += __builtin_popcount(newlines);
+    }
+  }
+}
+
+inline size_t whitespaceLength(char const *p, int *lines) {
+  return runLength<false>(
+      p,
+      [](Block b) {
+        return either(either(eq(b, ' '), eq(b, '\t')),
+                      either(eq(b, '\r'), eq(b, '\n')));
+      },
+      lines);
+}
+
+inline size_t identifierLength(char const *p) {
+  return runLength<false>(
+      p,
+      [](Block b) {
+        return either(either(range(b, 'a', 'z'), range(b, 'A', 'Z')),
+                      either(range(b, '0', '9'), eq(b, '_')));
+      },
+      nullptr);
+}
+
+inline size_t digitLength(char const *p) {
+  return runLength<false>(
+      p, [](Block b) { return range(b, '0', '9'); }, nullptr);
+}
+
+// Up to, not including, the next newline or NUL.
+inline size_t commentLength(char const *p) {
+  return runLength<true>(
+      p, [](Block b) { return either(eq(b, '\n'), eq(b, '\0')); }, nullptr);
+}
+
+// Up to, not including, the next '"' or NUL.
+inline size_t stringLength(char const *p, int *lines) {
+  return runLength<true>(
+      p, [](Block b) { return either(eq(b, '"'), eq(b, '\0')); }, lines);
+}
+
+#else
+
+inline size_t whitespaceLength(char const *p, int *lines) {
+  size_t n = 0;
+  for (;; n++) {
+    char c = p[n];
+    if (c == '\n') {
+      (*lines)++;
+    } else if (c != ' ' && c != '\t' && c != '\r') {
+      return n;
+    }
+  }
+}
+
+inline size_t identifierLength(char const *p) {
+  size_t n = 0;
+  for (char c = p[n]; (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                      (c >= '0' && c <= '9') || c == '_';
+       c = p[++n]) {
+  }
+  return n;
+}
+
+inline size_t digitLength(char const *p) {
+  size_t n = 0;
+  while (p[n] >= '0' && p[n] <= '9') {
+    n++;
+  }
+  return n;
+}
+
+inline size_t commentLength(char const *p) {
+  size_t n = 0;
+  while (p[n] != '\n' && p[n] != '\0') {
+    n++;
+  }
+  return n;
+}
+
+inline size_t stringLength(char const *p, int *lines) {
+  size_t n = 0;
+  for (; p[n] != '"' && p[n] != '\0'; n++) {
+    if (p[n] == '\n') {
+      (*lines)++;
+    }
+  }
+  return n;
+}
+
+#endif
+
+} // namespace lox::simd
+
+#endif
@@ -1,10 +1,16 @@
 #include "scanner.h"
+#include "keywords.h"
+#include "scan_simd.h"
 
 namespace lox {
-Scanner::Scanner(std::string const &_src) : src{_src} {
+Scanner::Scanner(std::string_view _src, int line) {
+  src.reserve(_src.length() + simd::SCAN_PADDING);
+  src = _src;
+  src.append(simd::SCAN_PADDING, '\0');
+  length = _src.length();
   start = 0;
   current = 0;
-  line = 1;
+  this->line = line;
 }
 
 Token Scanner::scanToken() {
@@ -61,18 +67,19 @@ Token Scanner::scanToken() {
 }
 
 Token Scanner::identifier() {
-  while (isAlpha(peek()) || isDigit(peek())) {
-    advance();
-  }
+  current += simd::identifierLength(src.data() + current);
   return makeToken(identifierType());
 }
 
 Token Scanner::string() {
-  while (peek() != '"' && !isAtEnd()) {
-    if (peek() == '\n') {
-      line++;
+  for (;;) {
+    current += simd::stringLength(src.data() + current, &line);
+    // A NUL inside the source is part of the string, not the sentinel.
+    if (peek() == '\0' && !isAtEnd()) {
+      advance();
+      continue;
     }
-    advance();
+    break;
   }
 
   if (isAtEnd()) {
@@ -84,80 +91,18 @@ Token Scanner::string() {
 }
 
 Token Scanner::number() {
-  while (isDigit(peek())) {
-    advance();
-  }
+  current += simd::digitLength(src.data() + current);
 
   if (peek() == '.' && isDigit(peekNext())) {
     advance();
-    while (isDigit(peek())) {
-      advance();
-    }
+    current += simd::digitLength(src.data() + current);
   }
 
   return makeToken(TOKEN_NUMBER);
 }
 
 TokenType Scanner::identifierType() {
-  switch (src[start]) {
-  case 'a':
-    return checkKeyword(1, "nd", TOKEN_AND);
-  case 'c':
-    return checkKeyword(1, "lass", TOKEN_CLASS);
-  case 'e':
-    return checkKeyword(1, "lse", TOKEN_ELSE);
-  case 'i':
-    return checkKeyword(1, "f", TOKEN_IF);
-  case 'n':
-    return checkKeyword(1, "il", TOKEN_NIL);
-  case 'o':
-    return checkKeyword(1, "r", TOKEN_OR);
-  case 'p':
-    return checkKeyword(1, "rint", TOKEN_PRINT);
-  case 'r':
-    return checkKeyword(1, "eturn", TOKEN_RETURN);
-  case 's':
-    return checkKeyword(1, "uper", TOKEN_SUPER);
-  case 'v':
-    return checkKeyword(1, "ar", TOKEN_VAR);
-  case 'w':
-    return checkKeyword(1, "hile", TOKEN_WHILE);
-  case 'f':
-    if (current - start > 1) {
-      switch (src[start + 1]) {
-      case 'a':
-        return checkKeyword(2, "lse", TOKEN_FALSE);
-      case 'o':
-        return checkKeyword(2, "r", TOKEN_FOR);
-      case 'u':
-        return checkKeyword(2, "n", TOKEN_FUN);
-      }
-    }
-    break;
-  case 't':
-    if (current - start > 1) {
-      switch (src[start + 1]) {
-      case 'h':
-        return checkKeyword(2, "is", TOKEN_THIS);
-      case 'r':
-        return checkKeyword(2, "ue", TOKEN_TRUE);
-      }
-    }
-    break;
-  }
-
-  return TOKEN_IDENTIFIER;
-}
-
-TokenType Scanner::checkKeyword(int offset, std::string const &rest,
-                                TokenType type) {
-  int identifierLength = offset + rest.length();
-  bool strEqual = rest.compare(src.substr(offset, rest.length())) == 0;
-  if (current - start == identifierLength && strEqual) {
-    return type;
-  }
-
-  return TOKEN_IDENTIFIER;
+  return keywords::classify(src.data() + start, current - start);
 }
 
 bool Scanner::isDigit(char c) { return c >= '0' && c <= '9'; }
@@ -167,12 +112,13 @@ bool Scanner::isAlpha(char c) {
 
 Token Scanner::makeToken(TokenType type) {
   Token t = {type, this->line,
-             this->src.substr(this->start, this->current - this->start)};
+             std::string_view{this->src}.substr(this->start,
+                                                this->current - this->start)};
   return t;
 }
 
-Token Scanner::errorToken(std::string s) {
-  Token t = {TOKEN_ERROR, this->line, s};
+Token Scanner::errorToken(char const *message) {
+  Token t = {TOKEN_ERROR, this->line, message};
   return t;
 }
 
@@ -195,38 +141,29 @@ bool Scanner::match(char expected) {
 
 void Scanner::skipWhiteSpace() {
   for (;;) {
+    // Tokens are often adjacent; skip the vector setup when no space follows.
     char c = peek();
-    switch (c) {
-    case ' ':
-    case '\t':
-    case '\r':
-      advance();
-      break;
-    case '\n':
-      line++;
-      advance();
-      break;
-    case '/':
-      if (peekNext() == '/') {
-        while (peek() != '\n' && !isAtEnd()) {
-          advance();
-        }
-      } else {
-        return;
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      current += simd::whitespaceLength(src.data() + current, &line);
+    }
+
+    if (peek() != '/' || peekNext() != '/') {
+      return;
+    }
+
+    for (;;) {
+      current += simd::commentLength(src.data() + current);
+      if (peek() == '\0' && !isAtEnd()) {
+        advance();
+        continue;
       }
       break;
-    default:
-      return;
     }
   }
 }
 
 char Scanner::peek() { return src[current]; }
-char Scanner::peekNext() {
-  if (isAtEnd()) {
-    return '\0';
-  }
-  return src[current + 1];
-}
+// Safe at the end too: the padding guarantees a NUL after the last byte.
+char Scanner::peekNext() { return src[current + 1]; }
 
 } // namespace lox
\ No newline at end of file
@@ -56,19 +56,29 @@ typedef enum {
   TOKEN_EOF
 } TokenType;
 
+// A token's text is a view into the scanner's source buffer (or, for error
+// tokens, a static message) and is only valid while the scanner is alive.
 typedef struct {
   TokenType type;
   int line;
-  std::string str;
+  std::string_view str;
 } Token;
 
 class Scanner {
 public:
-  Scanner(std::string const &_src);
+  // Scans _src, whose first line is numbered line.
+  Scanner(std::string_view _src, int line = 1);
   Token scanToken();
+  // Where token starts in the scanned source.
+  size_t offset(Token const &token) const {
+    return static_cast<size_t>(token.str.data() - src.data());
+  }
 
 private:
-  std::string const &src;
+  // A copy of the source followed by NUL padding, so the scanning kernels
+  // can read whole blocks and stop on the sentinel without bounds checks.
+  std::string src;
+  int length;
   int start;
   int current;
   int line;
@@ -79,13 +89,12 @@ private:
   Token makeToken(TokenType type);
   TokenType identifierType();
 
-  TokenType checkKeyword(int offset, std::string const &rest, TokenType type);
   bool isDigit(char);
   bool isAlpha(char);
-  bool isAtEnd() { return this->current == int(this->src.length()); }
+  bool isAtEnd() { return this->current == this->length; }
   char advance();
   bool match(char expected);
-  Token errorToken(std::string s);
+  Token errorToken(char const *message);
   void skipWhiteSpace();
   char peek();
   char peekNext();
@@ -0,0 +1,554 @@
+#include "server.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lazy.h"
+#include "vm.h"
+
+namespace lox {
+
+namespace {
+
+// Compiled scripts stay in the warm VM's heap until the VM goes, so past
+// this many the server starts over with a new one.
+constexpr size_t MAX_SCRIPTS = 256;
+// Further requests wait in the listen backlog.
+constexpr size_t MAX_RUNNING = 64;
+// Connections whose requests are still arriving.
+constexpr size_t MAX_PENDING = 64;
+constexpr int REQUEST_TIMEOUT_SECONDS = 5;
+
+// Signals are written here and handled from the poll loop.
+int signalPipe[2] = {-1, -1};
+
+void onSignal(int signal) {
+  int saved = errno;
+  char byte = static_cast<char>(signal);
+  (void)!write(signalPipe[1], &byte, 1);
+  errno = saved;
+}
+
+// Empties the signal pipe. Returns whether anything but SIGCHLD came.
+bool drainSignals() {
+  bool stop = false;
+  char signals[64];
+  ssize_t count;
+  while ((count = read(signalPipe[0], signals, sizeof(signals))) > 0) {
+    for (ssize_t i = 0; i < count; i++) {
+      stop = stop || signals[i] != SIGCHLD;
+    }
+  }
+  return stop;
+}
+
+void handleSignals(void (*handler)(int)) {
+  struct sigaction action {};
+  action.sa_handler = handler;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&action.sa_mask);
+  for (int signal : {SIGCHLD, SIGINT, SIGTERM}) {
+    sigaction(signal, &action, nullptr);
+  }
+}
+
+class Descriptor {
+public:
+  explicit Descriptor(int fd = -1) : fd{fd} {}
+  Descriptor(Descriptor const &) = delete;
+  Descriptor &operator=(Descriptor const &) = delete;
+  ~Descriptor() { reset(); }
+
+  int get() const { return fd; }
+  int release() { return std::exchange(fd, -1); }
+  void reset(int other = -1) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = other;
+  }
+
+private:
+  int fd;
+};
+
+struct Request {
+  RequestKind kind = RequestKind::Path;
+  std::string payload;
+  // The client's standard output and error.
+  Descriptor out;
+  Descriptor err;
+};
+
+void writeAll(int fd, std::string_view text) {
+  while (!text.empty()) {
+    ssize_t written = write(fd, text.data(), text.size());
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;
+    }
+    text.remove_prefix(static_cast<size_t>(written));
+  }
+}
+
+void reply(int connection, int32_t status) {
+  send(connection, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+// A connection whose request is still arriving. Bytes come in as the
+// socket has them, the header first and then the payload.
+struct Pending {
+  Descriptor connection;
+  Request request;
+  RequestHeader header{};
+  size_t received = 0;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+enum class ReadResult { Incomplete, Done, Failed };
+
+// Takes ownership of the descriptors in message: the client's standard
+// output, then its standard error.
+void takeDescriptors(msghdr &message, Request &request) {
+  for (cmsghdr *part = CMSG_FIRSTHDR(&message); part != nullptr;
+       part = CMSG_NXTHDR(&message, part)) {
+    if (part->cmsg_level != SOL_SOCKET || part->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (part->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int fd;
+      std::memcpy(&fd, CMSG_DATA(part) + i * sizeof(int), sizeof(fd));
+      if (request.out.get() < 0) {
+        request.out.reset(fd);
+      } else if (request.err.get() < 0) {
+        request.err.reset(fd);
+      } else {
+        close(fd);
+      }
+    }
+  }
+}
+
+// Reads whatever the socket has without blocking.
+ReadResult readRequest(Pending &pending) {
+  Request &request = pending.request;
+  RequestHeader &header = pending.header;
+  while (pending.received < sizeof(header)) {
+    iovec io{reinterpret_cast<char *>(&header) + pending.received,
+             sizeof(header) - pending.received};
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(pending.connection.get(), &message,
+                               MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return ReadResult::Incomplete;
+    }
+    // Take ownership of whatever was sent before looking at anything else.
+    if (received > 0) {
+      takeDescriptors(message, request);
+    }
+    if (received <= 0 || (message.msg_flags & MSG_CTRUNC)) {
+      return ReadResult::Failed;
+    }
+    pending.received += static_cast<size_t>(received);
+    if (pending.received < sizeof(header)) {
+      continue;
+    }
+    if (request.err.get() < 0 || header.version != PROTOCOL_VERSION ||
+        (header.kind != RequestKind::Path &&
+         header.kind != RequestKind::Source) ||
+        header.length > MAX_REQUEST_LENGTH) {
+      return ReadResult::Failed;
+    }
+    request.kind = header.kind;
+    request.payload.resize(header.length);
+  }
+
+  while (pending.received < sizeof(header) + header.length) {
+    size_t done = pending.received - sizeof(header);
+    ssize_t received =
+        recv(pending.connection.get(), request.payload.data() + done,
+             header.length - done, MSG_DONTWAIT);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return ReadResult::Incomplete;
+    }
+    if (received <= 0) {
+      return ReadResult::Failed;
+    }
+    pending.received += static_cast<size_t>(received);
+  }
+  return ReadResult::Done;
+}
+
+bool readFile(std::string const &path, std::string &src) {
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    return false;
+  }
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  src = buffer.str();
+  return true;
+}
+
+// Binds the socket, replacing one left behind by a server that has gone
+// but refusing to take over from a live one.
+int listenOn(char const *path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << path << "\n";
+    return -1;
+  }
+  std::strcpy(address.sun_path, path);
+  auto *socketAddress = reinterpret_cast<sockaddr *>(&address);
+
+  struct stat info;
+  if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+    Descriptor probe{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (connect(probe.get(), socketAddress, sizeof(address)) == 0) {
+      std::cerr << "Already serving on " << path << "\n";
+      return -1;
+    }
+    unlink(path);
+  }
+
+  Descriptor listener{socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+  if (listener.get() < 0 ||
+      bind(listener.get(), socketAddress, sizeof(address)) != 0 ||
+      listen(listener.get(), SOMAXCONN) != 0) {
+    std::cerr << "Can't listen on " << path << ": " << std::strerror(errno)
+              << "\n";
+    return -1;
+  }
+  return listener.release();
+}
+
+class Server {
+public:
+  Server(size_t heapLimit, unsigned timeLimit)
+      : heapLimit{heapLimit}, timeLimit{timeLimit} {
+    reset();
+  }
+  int run(char const *path);
+
+private:
+  size_t heapLimit;
+  unsigned timeLimit;
+  int listener = -1;
+  std::unique_ptr<VM> vm;
+  // Keyed by source, so an edited script is compiled afresh.
+  std::unordered_map<std::string, ObjFunction *> scripts;
+  // The connection each running child's status goes back on.
+  std::unordered_map<pid_t, int> running;
+  std::list<Pending> pending;
+
+  void reset();
+  void accept();
+  void readPending(std::vector<pollfd> const &fds);
+  void start(Pending &request);
+  ObjFunction *compile(std::string const &src, Request const &request);
+  [[noreturn]] void runChild(ObjFunction *script, Request const &request);
+  void finish(pid_t pid, int status);
+  void reap();
+  void shutDown();
+};
+
+void Server::reset() {
+  scripts.clear();
+  vm = nullptr;
+  clearCompileCache();
+  vm = std::make_unique<VM>();
+}
+
+int Server::run(char const *path) {
+  this->listener = listenOn(path);
+  if (this->listener < 0) {
+    return 74;
+  }
+  if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    std::cerr << "Can't create a pipe: " << std::strerror(errno) << "\n";
+    return 74;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  handleSignals(onSignal);
+
+  for (bool stopping = false; !stopping;) {
+    // Requests are only read while there is room to run them; until then
+    // they wait in their sockets, and their time doesn't run out.
+    bool room = running.size() < MAX_RUNNING;
+    std::vector<pollfd> fds{
+        {signalPipe[0], POLLIN, 0},
+        {this->listener,
+         static_cast<short>(room && pending.size() < MAX_PENDING ? POLLIN
+                                                                 : 0),
+         0},
+    };
+    int timeout = -1;
+    if (room) {
+      auto now = std::chrono::steady_clock::now();
+      for (Pending &request : pending) {
+        fds.push_back({request.connection.get(), POLLIN, 0});
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        request.deadline - now)
+                        .count();
+        left = left < 0 ? 0 : left + 1;
+        timeout = timeout < 0 || left < timeout ? static_cast<int>(left)
+                                                : timeout;
+      }
+    }
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      continue;
+    }
+    if (fds[0].revents & POLLIN) {
+      stopping = drainSignals();
+      reap();
+    }
+    if (stopping) {
+      break;
+    }
+    if (room) {
+      readPending(fds);
+    }
+    if (fds[1].revents & POLLIN) {
+      accept();
+    }
+  }
+
+  close(this->listener);
+  unlink(path);
+  pending.clear();
+  shutDown();
+  return 0;
+}
+
+// Gives running scripts the grace period to finish, so their clients still
+// get a status, then kills the rest. Another SIGINT or SIGTERM ends the
+// wait early.
+void Server::shutDown() {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds{SHUTDOWN_GRACE_SECONDS};
+  reap();
+  while (!running.empty()) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+      break;
+    }
+    pollfd fd{signalPipe[0], POLLIN, 0};
+    poll(&fd, 1, static_cast<int>(left.count()));
+    bool stop = drainSignals();
+    reap();
+    if (stop) {
+      break;
+    }
+  }
+
+  for (auto const &[pid, connection] : running) {
+    kill(pid, SIGKILL);
+  }
+  int status;
+  pid_t pid;
+  while (!running.empty() && (pid = waitpid(-1, &status, 0)) > 0) {
+    finish(pid, status);
+  }
+}
+
+void Server::accept() {
+  int connection = accept4(this->listener, nullptr, nullptr,
+                           SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (connection < 0) {
+    return;
+  }
+  Pending &request = pending.emplace_back();
+  request.connection.reset(connection);
+  request.deadline = std::chrono::steady_clock::now() +
+                     std::chrono::seconds{REQUEST_TIMEOUT_SECONDS};
+}
+
+// Reads from the pending connections poll found ready, which follow the
+// signal pipe and the listener in fds, then drops those out of time.
+void Server::readPending(std::vector<pollfd> const &fds) {
+  auto now = std::chrono::steady_clock::now();
+  size_t i = 2;
+  for (auto request = pending.begin();
+       request != pending.end() && i < fds.size() &&
+       running.size() < MAX_RUNNING;
+       i++) {
+    ReadResult result = ReadResult::Incomplete;
+    if (fds[i].revents != 0) {
+      // A malformed request just gets the connection closed.
+      result = readRequest(*request);
+    }
+    if (result == ReadResult::Done) {
+      start(*request);
+    }
+    if (result != ReadResult::Incomplete || request->deadline <= now) {
+      request = pending.erase(request);
+    } else {
+      ++request;
+    }
+  }
+}
+
+void Server::start(Pending &pending) {
+  Request &request = pending.request;
+  int connection = pending.connection.get();
+  std::string src;
+  if (request.kind == RequestKind::Source) {
+    src = std::move(request.payload);
+  } else if (!readFile(request.payload, src)) {
+    writeAll(request.err.get(), "Unable to open file\n");
+    reply(connection, 74);
+    return;
+  }
+
+  ObjFunction *script = compile(src, request);
+  if (script == nullptr) {
+    reply(connection, 65);
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    runChild(script, request);
+  }
+  if (pid < 0) {
+    writeAll(request.err.get(), "Can't start the script: " +
+                                    std::string{std::strerror(errno)} + "\n");
+    reply(connection, 70);
+    return;
+  }
+  running.emplace(pid, pending.connection.release());
+}
+
+// Compiles in the server, so every later run of the same source starts
+// with it compiled. Listings and errors go to the client.
+ObjFunction *Server::compile(std::string const &src, Request const &request) {
+  auto found = scripts.find(src);
+  if (found != scripts.end()) {
+    return found->second;
+  }
+  if (scripts.size() == MAX_SCRIPTS) {
+    reset();
+  }
+
+  int savedOut = dup(1);
+  int savedErr = dup(2);
+  dup2(request.out.get(), 1);
+  dup2(request.err.get(), 2);
+  ObjFunction *script = nullptr;
+  bool failed = false;
+  try {
+    script = vm->compile(src);
+    if (script != nullptr) {
+      vm->compileFunctions(script);
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    script = nullptr;
+    failed = true;
+  }
+  vm->output().flush();
+  std::fflush(stderr);
+  dup2(savedOut, 1);
+  dup2(savedErr, 2);
+  close(savedOut);
+  close(savedErr);
+
+  if (failed) {
+    // The VM may have run out of memory partway.
+    reset();
+  } else if (script != nullptr) {
+    scripts.emplace(src, script);
+  }
+  return script;
+}
+
+void Server::runChild(ObjFunction *script, Request const &request) {
+  handleSignals(SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  close(signalPipe[0]);
+  close(signalPipe[1]);
+  close(this->listener);
+  for (auto const &[pid, connection] : running) {
+    close(connection);
+  }
+  for (Pending &other : pending) {
+    close(other.connection.get());
+  }
+  dup2(request.out.get(), 1);
+  dup2(request.err.get(), 2);
+
+  vm->memoryAccount().setLimit(this->heapLimit);
+  // The client sees each line as it's printed, not all of it at the end.
+  vm->output().setLineBuffered(true);
+  // SIGALRM's default action ends the script, whatever it is waiting on.
+  alarm(this->timeLimit);
+  InterpretResult result = vm->interpret(script);
+  std::fflush(nullptr);
+  // The heap is a copy of the server's; skip tearing it down.
+  _exit(result == INTERPRET_COMPILE_ERROR   ? 65
+        : result == INTERPRET_RUNTIME_ERROR ? 70
+                                            : 0);
+}
+
+void Server::finish(pid_t pid, int status) {
+  auto found = running.find(pid);
+  if (found == running.end()) {
+    return;
+  }
+  reply(found->second,
+        WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+  close(found->second);
+  running.erase(found);
+}
+
+void Server::reap() {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    finish(pid, status);
+  }
+}
+
+} // namespace
+
+int serve(char const *path, size_t heapLimit, unsigned timeLimit) {
+  return Server{heapLimit, timeLimit}.run(path);
+}
+
+} // namespace lox
@@ -0,0 +1,51 @@
+#ifndef cpplox_server_h
+#define cpplox_server_h
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lox {
+
+// A daemon that runs scripts for clients on the same machine, so short jobs
+// skip process start-up, VM construction and compilation. The server keeps
+// a warm VM and compiles each distinct script into it once, function bodies
+// included. Every request then runs in a child forked from the server, which
+// starts from that VM with nothing left to compile and can't disturb it or
+// any other request.
+//
+// A client connects to the socket and sends a RequestHeader, with its
+// standard output and error attached as SCM_RIGHTS, then length bytes of
+// payload: the script's absolute path, or its source. The script's output
+// goes to the client's descriptors a line at a time as it runs. When it
+// finishes the server replies with an int32_t exit status: 0, 65 for a
+// compile error, 70 for a runtime error, 74 if the script can't be read, or
+// 128 plus the signal that killed it: SIGALRM for a script that ran out of
+// time, or SIGKILL for one still running when the server's shutdown grace
+// period ended.
+
+constexpr uint32_t PROTOCOL_VERSION = 1;
+constexpr uint32_t MAX_REQUEST_LENGTH = 64 * 1024 * 1024;
+constexpr unsigned DEFAULT_TIME_LIMIT_SECONDS = 60;
+// How long scripts still running at shutdown get to finish.
+constexpr int SHUTDOWN_GRACE_SECONDS = 10;
+
+enum class RequestKind : uint32_t { Path, Source };
+
+struct RequestHeader {
+  uint32_t version;
+  RequestKind kind;
+  uint32_t length;
+};
+
+// Serves requests on a UNIX domain socket at path until SIGINT or SIGTERM,
+// then gives running scripts SHUTDOWN_GRACE_SECONDS, or until a second
+// signal, before killing them. A nonzero heapLimit caps the bytes each
+// script can allocate, on top of what the warm VM already holds, and a
+// nonzero timeLimit the seconds it can run. Returns the process exit
+// status.
+int serve(char const *path, size_t heapLimit,
+          unsigned timeLimit = DEFAULT_TIME_LIMIT_SECONDS);
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,48 @@
+#include "shape.h"
+
+#include <new>
+
+namespace lox {
+
+Shape::~Shape() {
+  for (auto &[name, next] : transitions) {
+    if (next != nullptr) {
+      next->~Shape();
+      memory->deallocate(next, sizeof(Shape), alignof(Shape));
+    }
+  }
+}
+
+int Shape::lookup(ObjString *name) const {
+  auto found = slots.find(name);
+  return found == slots.end() ? -1 : static_cast<int>(found->second);
+}
+
+std::vector<ObjString *> Shape::fieldNames() const {
+  std::vector<ObjString *> names(slots.size());
+  for (auto &[name, slot] : slots) {
+    names[slot] = name;
+  }
+  return names;
+}
+
+Shape *Shape::transition(ObjString *name) {
+  auto &next = transitions[name];
+  if (next == nullptr) {
+    void *storage = memory->allocate(sizeof(Shape), alignof(Shape));
+    auto shape = new (storage) Shape{memory};
+    try {
+      shape->slots = slots;
+      shape->slots.emplace(name, static_cast<uint32_t>(slots.size()));
+    } catch (...) {
+      shape->~Shape();
+      memory->deallocate(storage, sizeof(Shape), alignof(Shape));
+      throw;
+    }
+    next = shape;
+  }
+
+  return next;
+}
+
+} // namespace lox
@@ -0,0 +1,41 @@
+#ifndef cpplox_shape_h
+#define cpplox_shape_h
+
+#include <cstdint>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+class ObjString;
+
+// A hidden class: maps field names to indices in an instance's field array.
+// Instances that gained the same fields in the same order share a shape, so
+// a shape pointer comparison is enough to validate a cached field index.
+class Shape {
+public:
+  explicit Shape(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : memory{memory}, slots{memory}, transitions{memory} {}
+  Shape(Shape const &) = delete;
+  Shape &operator=(Shape const &) = delete;
+  ~Shape();
+
+  // Returns the field index of name, or -1 if the shape has no such field.
+  int lookup(ObjString *name) const;
+  // Returns the shape reached by appending name, creating it on first use.
+  Shape *transition(ObjString *name);
+  size_t fieldCount() const { return slots.size(); }
+  // Field names in slot order.
+  std::vector<ObjString *> fieldNames() const;
+
+private:
+  std::pmr::memory_resource *memory;
+  std::pmr::unordered_map<ObjString *, uint32_t> slots;
+  // Child shapes are owned by their parent and come from the same resource.
+  std::pmr::unordered_map<ObjString *, Shape *> transitions;
+};
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,635 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "lazy.h"
+#include "object.h"
+#include "verifier.h"
+#include "vm.h"
+
+namespace lox {
+
+namespace {
+
+constexpr char MAGIC[8] = {'L', 'O', 'X', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t VERSION = 8;
+
+enum ArrayKind : uint8_t {
+  ARRAY_OWNED,
+  ARRAY_SLICE,
+  ARRAY_FROZEN,
+};
+
+enum ValueTag : uint8_t {
+  TAG_NIL,
+  TAG_BOOL,
+  TAG_NUMBER,
+  TAG_OBJECT,
+  TAG_INTEGER,
+};
+
+// Objects are written grouped by type in this order, so the references an
+// object needs at construction - a class's name, an instance's class, a
+// bound method's function, a slice's base array - always point back to
+// objects already restored. Within a type they keep creation order, which
+// puts arrays before their slices.
+int constructionRank(ObjType type) {
+  switch (type) {
+  case ObjType::Array:
+    return 6;
+  case ObjType::String:
+    return 0;
+  case ObjType::Function:
+    return 1;
+  case ObjType::Class:
+    return 2;
+  case ObjType::Instance:
+    return 3;
+  case ObjType::BoundMethod:
+    return 4;
+  case ObjType::Native:
+    return 5;
+  case ObjType::Map:
+    return 7;
+  case ObjType::Channel:
+    break;
+  }
+  return 8;
+}
+
+class Writer {
+public:
+  explicit Writer(std::unordered_map<Object *, uint32_t> const &indices)
+      : indices{indices} {}
+
+  std::string bytes;
+
+  void u8(uint8_t value) { bytes.push_back(static_cast<char>(value)); }
+  void u32(uint32_t value) { raw(&value, sizeof(value)); }
+  void u64(uint64_t value) { raw(&value, sizeof(value)); }
+  void raw(void const *data, size_t size) {
+    bytes.append(static_cast<char const *>(data), size);
+  }
+  void string(std::string_view chars) {
+    u32(static_cast<uint32_t>(chars.size()));
+    raw(chars.data(), chars.size());
+  }
+  void object(Object *object) { u32(indices.at(object)); }
+
+  void value(Value value) {
+    if (auto number = std::get_if<double>(&value)) {
+      u8(TAG_NUMBER);
+      raw(number, sizeof(*number));
+    } else if (auto integer = std::get_if<int64_t>(&value)) {
+      u8(TAG_INTEGER);
+      raw(integer, sizeof(*integer));
+    } else if (auto boolean = std::get_if<bool>(&value)) {
+      u8(TAG_BOOL);
+      u8(*boolean);
+    } else if (auto object = std::get_if<Object *>(&value)) {
+      u8(TAG_OBJECT);
+      this->object(*object);
+    } else {
+      u8(TAG_NIL);
+    }
+  }
+
+private:
+  std::unordered_map<Object *, uint32_t> const &indices;
+};
+
+class Reader {
+public:
+  Reader(uint8_t const *data, size_t size) : data{data}, end{data + size} {}
+
+  uint8_t const *take(size_t size) {
+    if (size > static_cast<size_t>(end - data)) {
+      throw SnapshotError("Snapshot is truncated.");
+    }
+    uint8_t const *start = data;
+    data += size;
+    return start;
+  }
+  void raw(void *out, size_t size) { std::memcpy(out, take(size), size); }
+  uint8_t u8() { return *take(1); }
+  uint32_t u32() {
+    uint32_t value;
+    raw(&value, sizeof(value));
+    return value;
+  }
+  uint64_t u64() {
+    uint64_t value;
+    raw(&value, sizeof(value));
+    return value;
+  }
+  // Reads an element count, rejecting counts the rest of the image is too
+  // short to hold before anything is sized from them.
+  uint32_t count(size_t elementSize) {
+    uint32_t count = u32();
+    if (count > static_cast<size_t>(end - data) / elementSize) {
+      throw SnapshotError("Snapshot is truncated.");
+    }
+    return count;
+  }
+  std::string_view string() {
+    uint32_t size = u32();
+    return {reinterpret_cast<char const *>(take(size)), size};
+  }
+  bool done() const { return data == end; }
+
+private:
+  uint8_t const *data;
+  uint8_t const *end;
+};
+
+class Loader {
+public:
+  Loader(Heap &heap, Globals &globals, ObjString *initString, Reader reader)
+      : heap{heap}, globals{globals}, nativeCount{globals.size()},
+        initString{initString}, in{reader} {}
+
+  void run();
+
+private:
+  // A value slot that refers to an object which may not exist yet.
+  struct Fixup {
+    Value *slot;
+    uint32_t index;
+  };
+  // Keys are hashed by identity, so a map is only filled once every object
+  // it holds exists.
+  struct MapEntries {
+    ObjMap *map;
+    // Keys and values alternating.
+    std::vector<Value> entries;
+  };
+
+  Heap &heap;
+  Globals &globals;
+  // Globals the host bound to natives before loading.
+  size_t nativeCount;
+  ObjString *initString;
+  Reader in;
+  uint32_t objectCount = 0;
+  std::vector<Object *> objects;
+  std::vector<Fixup> fixups;
+  std::vector<MapEntries> maps;
+
+  void readObject();
+  void readValue(Value *slot);
+  template <typename T> T *readReference(ObjType type);
+  [[noreturn]] void malformed() {
+    throw SnapshotError("Snapshot is malformed.");
+  }
+};
+
+void Loader::run() {
+  char magic[sizeof(MAGIC)];
+  in.raw(magic, sizeof(magic));
+  if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+    throw SnapshotError("Not a snapshot file.");
+  }
+  if (in.u32() != VERSION) {
+    throw SnapshotError("Snapshot was written by a different version.");
+  }
+
+  this->objectCount = in.u32();
+  for (uint32_t i = 0; i < this->objectCount; i++) {
+    readObject();
+  }
+
+  // Resolve every name first so that the value slots below stay put.
+  uint32_t globalCount = in.u32();
+  for (uint32_t i = 0; i < globalCount; i++) {
+    size_t index = globals.resolve(readReference<ObjString>(ObjType::String));
+    if (index != i && (index < nativeCount || i < nativeCount)) {
+      throw SnapshotError(
+          "Snapshot was saved with different native functions.");
+    }
+    if (index != i) {
+      malformed();
+    }
+  }
+  for (uint32_t i = 0; i < globalCount; i++) {
+    globals[i].defined = in.u8() != 0;
+    readValue(&globals[i].value);
+  }
+
+  if (!in.done()) {
+    malformed();
+  }
+
+  for (Fixup const &fixup : this->fixups) {
+    if (fixup.index >= this->objects.size()) {
+      malformed();
+    }
+    *fixup.slot = this->objects[fixup.index];
+  }
+
+  for (MapEntries const &pending : this->maps) {
+    Table &table = pending.map->table;
+    for (size_t i = 0; i < pending.entries.size(); i += 2) {
+      double const *number = std::get_if<double>(&pending.entries[i]);
+      if ((number != nullptr && std::isnan(*number)) ||
+          !table.set(pending.entries[i], pending.entries[i + 1])) {
+        malformed();
+      }
+    }
+  }
+
+  for (Object *object : this->objects) {
+    if (object->type != ObjType::Function) {
+      continue;
+    }
+    try {
+      verifyFunction(static_cast<ObjFunction *>(object), globals.size());
+    } catch (VerifyError const &error) {
+      throw SnapshotError(error.what());
+    }
+  }
+}
+
+void Loader::readObject() {
+  switch (static_cast<ObjType>(in.u8())) {
+  case ObjType::String:
+    this->objects.push_back(heap.intern(in.string()));
+    break;
+  case ObjType::Function: {
+    auto function = heap.allocate<ObjFunction>();
+    this->objects.push_back(function);
+    uint32_t arity = in.u32();
+    if (arity > UINT8_MAX) {
+      malformed();
+    }
+    function->arity = static_cast<int>(arity);
+    function->name = in.string();
+
+    Chunk &chunk = function->chunk;
+    uint32_t codeCount = in.u32();
+    uint8_t const *codes = in.take(codeCount);
+    chunk.codes.assign(codes, codes + codeCount);
+    chunk.lines.resize(in.count(sizeof(uint64_t)));
+    for (size_t &line : chunk.lines) {
+      line = in.u64();
+    }
+    chunk.constants.resize(in.count(1));
+    for (Value &constant : chunk.constants) {
+      readValue(&constant);
+    }
+    // Cached shapes and loop traces belong to the writing process; start
+    // them cold.
+    uint32_t cacheCount = in.u32();
+    uint32_t loopCount = in.u32();
+    if (cacheCount > UINT16_MAX + 1 || loopCount > UINT16_MAX + 1) {
+      malformed();
+    }
+    chunk.caches.resize(cacheCount);
+    chunk.loops.resize(loopCount);
+    break;
+  }
+  case ObjType::Class: {
+    auto klass =
+        heap.allocate<ObjClass>(readReference<ObjString>(ObjType::String));
+    this->objects.push_back(klass);
+    uint32_t methodCount = in.u32();
+    for (uint32_t i = 0; i < methodCount; i++) {
+      auto name = readReference<ObjString>(ObjType::String);
+      auto method = readReference<ObjFunction>(ObjType::Function);
+      klass->methods[name] = method;
+      if (name == this->initString) {
+        klass->initializer = method;
+      }
+    }
+    break;
+  }
+  case ObjType::Instance: {
+    auto instance =
+        heap.allocate<ObjInstance>(readReference<ObjClass>(ObjType::Class));
+    this->objects.push_back(instance);
+    uint32_t fieldCount = in.count(sizeof(uint32_t) + 1);
+    instance->fields.resize(fieldCount);
+    // Replaying the field names in slot order rebuilds the same shape.
+    for (uint32_t i = 0; i < fieldCount; i++) {
+      instance->shape = instance->shape->transition(
+          readReference<ObjString>(ObjType::String));
+      readValue(&instance->fields[i]);
+    }
+    if (instance->shape->fieldCount() != fieldCount) {
+      malformed();
+    }
+    break;
+  }
+  case ObjType::Array: {
+    uint8_t kind = in.u8();
+    if (kind == ARRAY_SLICE) {
+      auto base = readReference<ObjArray>(ObjType::Array);
+      uint64_t offset = in.u64();
+      uint64_t length = in.u64();
+      if (base->base != nullptr || offset > base->length ||
+          length > base->length - offset) {
+        malformed();
+      }
+      this->objects.push_back(heap.allocate<ObjArray>(base, offset, length));
+      break;
+    }
+    if (kind != ARRAY_OWNED && kind != ARRAY_FROZEN) {
+      malformed();
+    }
+    size_t length = in.count(sizeof(double));
+    ObjArray *array;
+    if (kind == ARRAY_FROZEN) {
+      std::shared_ptr<double[]> buffer{new double[length]};
+      double *data = buffer.get();
+      array = heap.allocate<ObjArray>(std::move(buffer), data, length);
+    } else {
+      array = heap.allocate<ObjArray>(length, 0.0);
+    }
+    this->objects.push_back(array);
+    if (length != 0) {
+      in.raw(array->data, length * sizeof(double));
+    }
+    break;
+  }
+  case ObjType::Map: {
+    auto map = heap.allocate<ObjMap>();
+    this->objects.push_back(map);
+    // Each key and value takes at least its tag byte.
+    std::vector<Value> entries(size_t{2} * in.count(2));
+    for (Value &entry : entries) {
+      readValue(&entry);
+    }
+    // Moving the vector keeps the slots the fixups point into.
+    this->maps.push_back(MapEntries{map, std::move(entries)});
+    break;
+  }
+  case ObjType::Native: {
+    // Natives are host code; the image only names them, and the loading
+    // host must have bound the same ones.
+    auto name = readReference<ObjString>(ObjType::String);
+    Global *global = globals.find(name);
+    if (global == nullptr || !isNative(global->value) ||
+        asNative(global->value)->name != name) {
+      throw SnapshotError("Snapshot needs the native function '" +
+                          std::string{name->chars} + "'.");
+    }
+    this->objects.push_back(asNative(global->value));
+    break;
+  }
+  case ObjType::BoundMethod: {
+    auto method = readReference<ObjFunction>(ObjType::Function);
+    auto bound = heap.allocate<ObjBoundMethod>(Nil{}, method);
+    this->objects.push_back(bound);
+    readValue(&bound->receiver);
+    break;
+  }
+  default:
+    malformed();
+  }
+}
+
+void Loader::readValue(Value *slot) {
+  switch (in.u8()) {
+  case TAG_NIL:
+    *slot = Nil{};
+    break;
+  case TAG_BOOL:
+    *slot = in.u8() != 0;
+    break;
+  case TAG_NUMBER: {
+    double number;
+    in.raw(&number, sizeof(number));
+    *slot = number;
+    break;
+  }
+  case TAG_INTEGER: {
+    int64_t integer;
+    in.raw(&integer, sizeof(integer));
+    if (!fitsInteger(integer)) {
+      malformed();
+    }
+    *slot = integer;
+    break;
+  }
+  case TAG_OBJECT: {
+    uint32_t index = in.u32();
+    if (index >= this->objectCount) {
+      malformed();
+    }
+    this->fixups.push_back(Fixup{slot, index});
+    break;
+  }
+  default:
+    malformed();
+  }
+}
+
+// Reads a reference to an object that must already have been restored.
+template <typename T> T *Loader::readReference(ObjType type) {
+  uint32_t index = in.u32();
+  if (index >= this->objects.size() || this->objects[index]->type != type) {
+    malformed();
+  }
+  return static_cast<T *>(this->objects[index]);
+}
+
+} // namespace
+
+void Snapshot::save(VM &vm, std::string const &path) {
+  if (vm.suspended()) {
+    throw SnapshotError("Can't snapshot a suspended script.");
+  }
+
+  // Images hold bytecode, so compile the functions that haven't run yet.
+  // Compiling one can add more, nested in it, at the head of the heap.
+  for (bool compiled = true; compiled;) {
+    compiled = false;
+    for (Object *object = vm.heap.head(); object != nullptr;
+         object = object->next) {
+      if (object->type != ObjType::Function) {
+        continue;
+      }
+      auto function = static_cast<ObjFunction *>(object);
+      if (function->lazy != nullptr) {
+        try {
+          compileLazy(function, vm.globals, vm.heap, vm.out);
+        } catch (std::runtime_error &e) {
+          throw SnapshotError(e.what());
+        }
+        compiled = true;
+      }
+    }
+  }
+
+  std::vector<Object *> objects;
+  for (Object *object = vm.heap.head(); object != nullptr;
+       object = object->next) {
+    objects.push_back(object);
+  }
+  std::reverse(objects.begin(), objects.end());
+  std::stable_sort(objects.begin(), objects.end(), [](auto a, auto b) {
+    return constructionRank(a->type) < constructionRank(b->type);
+  });
+
+  std::unordered_map<Object *, uint32_t> indices;
+  for (Object *object : objects) {
+    indices.emplace(object, static_cast<uint32_t>(indices.size()));
+  }
+
+  Writer out{indices};
+  out.raw(MAGIC, sizeof(MAGIC));
+  out.u32(VERSION);
+  out.u32(static_cast<uint32_t>(objects.size()));
+
+  for (Object *object : objects) {
+    out.u8(static_cast<uint8_t>(object->type));
+    switch (object->type) {
+    case ObjType::String:
+      out.string(static_cast<ObjString *>(object)->chars);
+      break;
+    case ObjType::Function: {
+      auto function = static_cast<ObjFunction *>(object);
+      Chunk &chunk = function->chunk;
+      out.u32(static_cast<uint32_t>(function->arity));
+      out.string(function->name);
+      out.u32(static_cast<uint32_t>(chunk.codes.size()));
+      out.raw(chunk.codes.data(), chunk.codes.size());
+      out.u32(static_cast<uint32_t>(chunk.lines.size()));
+      for (size_t line : chunk.lines) {
+        out.u64(line);
+      }
+      out.u32(static_cast<uint32_t>(chunk.constants.size()));
+      for (Value constant : chunk.constants) {
+        out.value(constant);
+      }
+      out.u32(static_cast<uint32_t>(chunk.caches.size()));
+      out.u32(static_cast<uint32_t>(chunk.loops.size()));
+      break;
+    }
+    case ObjType::Class: {
+      auto klass = static_cast<ObjClass *>(object);
+      out.object(klass->name);
+      out.u32(static_cast<uint32_t>(klass->methods.size()));
+      for (auto &[name, method] : klass->methods) {
+        out.object(name);
+        out.object(method);
+      }
+      break;
+    }
+    case ObjType::Instance: {
+      auto instance = static_cast<ObjInstance *>(object);
+      out.object(instance->klass);
+      out.u32(static_cast<uint32_t>(instance->fields.size()));
+      std::vector<ObjString *> names = instance->shape->fieldNames();
+      for (size_t i = 0; i < names.size(); i++) {
+        out.object(names[i]);
+        out.value(instance->fields[i]);
+      }
+      break;
+    }
+    case ObjType::BoundMethod: {
+      auto bound = static_cast<ObjBoundMethod *>(object);
+      out.object(bound->method);
+      out.value(bound->receiver);
+      break;
+    }
+    case ObjType::Native:
+      out.object(static_cast<ObjNative *>(object)->name);
+      break;
+    case ObjType::Channel:
+      // Channels connect live VMs, which an image can't bring back.
+      throw SnapshotError("Can't snapshot a channel.");
+    case ObjType::Map: {
+      Table &table = static_cast<ObjMap *>(object)->table;
+      out.u32(static_cast<uint32_t>(table.size()));
+      for (size_t i = table.next(0); i != table.capacity();
+           i = table.next(i + 1)) {
+        out.value(table.keyAt(i));
+        out.value(table.valueAt(i));
+      }
+      break;
+    }
+    case ObjType::Array: {
+      auto array = static_cast<ObjArray *>(object);
+      if (array->base != nullptr) {
+        out.u8(ARRAY_SLICE);
+        out.object(array->base);
+        out.u64(array->offset);
+        out.u64(array->length);
+        break;
+      }
+      if (array->length > UINT32_MAX) {
+        throw SnapshotError("Array too large for a snapshot.");
+      }
+      out.u8(array->frozen != nullptr ? ARRAY_FROZEN : ARRAY_OWNED);
+      out.u32(static_cast<uint32_t>(array->length));
+      if (array->length != 0) {
+        out.raw(array->data, array->length * sizeof(double));
+      }
+      break;
+    }
+    }
+  }
+
+  out.u32(static_cast<uint32_t>(vm.globals.size()));
+  for (size_t i = 0; i < vm.globals.size(); i++) {
+    out.object(vm.globals[i].name);
+  }
+  for (size_t i = 0; i < vm.globals.size(); i++) {
+    out.u8(vm.globals[i].defined);
+    out.value(vm.globals[i].value);
+  }
+
+  std::ofstream file{path, std::ios::binary | std::ios::trunc};
+  file.write(out.bytes.data(), static_cast<std::streamsize>(out.bytes.size()));
+  if (!file) {
+    throw SnapshotError("Unable to write snapshot '" + path + "'.");
+  }
+}
+
+void Snapshot::load(VM &vm, std::string const &path) {
+  for (size_t i = 0; i < vm.globals.size(); i++) {
+    if (!isNative(vm.globals[i].value)) {
+      throw SnapshotError("Snapshots can only be loaded into a fresh VM.");
+    }
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw SnapshotError("Unable to open snapshot '" + path + "'.");
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    throw SnapshotError("Unable to read snapshot '" + path + "'.");
+  }
+
+  size_t size = static_cast<size_t>(info.st_size);
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw SnapshotError("Unable to map snapshot '" + path + "'.");
+  }
+
+  try {
+    Reader reader{static_cast<uint8_t const *>(mapping), size};
+    Loader{vm.heap, vm.globals, vm.initString, reader}.run();
+  } catch (...) {
+    munmap(mapping, size);
+    throw;
+  }
+  munmap(mapping, size);
+}
+
+} // namespace lox
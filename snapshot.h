@@ -0,0 +1,37 @@
+#ifndef cpplox_snapshot_h
+#define cpplox_snapshot_h
+
+#include <stdexcept>
+#include <string>
+
+namespace lox {
+class VM;
+
+class SnapshotError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Saves an initialized VM - its globals and every heap object, including
+// compiled functions with their bytecode and constants - so another process
+// can start from that state instead of running the same prelude again.
+//
+// Objects refer to each other by index in the image, so it is relocatable.
+// Loading maps the file and rebuilds the objects from it directly; nothing
+// is recompiled or executed, and the restored bytecode is verified again
+// before it can run. Images are only valid for the build that wrote them.
+class Snapshot {
+public:
+  // Throws SnapshotError if a script is suspended or the file can't be
+  // written.
+  static void save(VM &vm, std::string const &path);
+  // vm must not have run anything yet. It must have bound the same natives,
+  // in the same order, as the VM that saved the image; natives are saved by
+  // name only. Throws SnapshotError if the image is unreadable or malformed,
+  // after which vm should be discarded.
+  static void load(VM &vm, std::string const &path);
+};
+
+} // namespace lox
+
+#endif
@@ -0,0 +1,249 @@
+#include "table.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "number.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lox {
+
+namespace {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Folds the two halves of a full 64x64-bit product together, so every
+// input bit reaches both the low bits used for control bytes and the high
+// bits used to pick groups, for the price of one multiplication.
+uint64_t mix(uint64_t bits) {
+  uint128_t product = static_cast<uint128_t>(bits) * 0x9e3779b97f4a7c15ULL;
+  return static_cast<uint64_t>(product) ^
+         static_cast<uint64_t>(product >> 64);
+}
+
+// Stores numbers that equal an integer as that integer, so equal numbers
+// are the same key with the same hash. Returns false for NaN.
+bool normalize(Value &key) {
+  double const *number = std::get_if<double>(&key);
+  if (number == nullptr) {
+    return true;
+  }
+  double real = *number;
+  if (std::isnan(real)) {
+    return false;
+  }
+  if (std::abs(real) <= static_cast<double>(MAX_INTEGER) &&
+      real == std::floor(real)) {
+    key.emplace<int64_t>(static_cast<int64_t>(real));
+  }
+  return true;
+}
+
+// The key's payload as a word: the integer, the object's address or the
+// double's bits. Nil has none.
+uint64_t keyBits(Value const &key) {
+  uint64_t bits = 0;
+  if (int64_t const *integer = std::get_if<int64_t>(&key)) {
+    bits = static_cast<uint64_t>(*integer);
+  } else if (Object *const *object = std::get_if<Object *>(&key)) {
+    bits = reinterpret_cast<uintptr_t>(*object);
+  } else if (double const *number = std::get_if<double>(&key)) {
+    std::memcpy(&bits, number, sizeof(bits));
+  } else if (bool const *boolean = std::get_if<bool>(&key)) {
+    bits = *boolean;
+  }
+  return bits;
+}
+
+uint64_t hashKey(Value const &key) {
+  return mix(keyBits(key) ^ (uint64_t{key.index()} << 56));
+}
+
+// Both keys are normalized, so the only doubles left are neither NaN nor
+// whole, and keys are equal exactly when their payloads are.
+bool sameKey(Value const &a, Value const &b) {
+  return a.index() == b.index() && keyBits(a) == keyBits(b);
+}
+
+// Bit i is set where control byte i of the group equals byte.
+uint32_t matchByte(uint8_t const *group, uint8_t byte) {
+#if defined(__SSE2__)
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(group));
+  return static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+  uint32_t bits = 0;
+  for (size_t i = 0; i < Table::GROUP_SIZE; i++) {
+    bits |= static_cast<uint32_t>(group[i] == byte) << i;
+  }
+  return bits;
+#endif
+}
+
+// Bit i is set where slot i of the group is empty: only EMPTY has the high
+// bit set.
+uint32_t matchEmpty(uint8_t const *group) {
+#if defined(__SSE2__)
+  return static_cast<uint32_t>(_mm_movemask_epi8(
+      _mm_loadu_si128(reinterpret_cast<__m128i const *>(group))));
+#else
+  uint32_t bits = 0;
+  for (size_t i = 0; i < Table::GROUP_SIZE; i++) {
+    bits |= static_cast<uint32_t>(group[i] >> 7) << i;
+  }
+  return bits;
+#endif
+}
+
+uint8_t controlByte(uint64_t hash) { return hash & 0x7f; }
+
+// Groups are visited at triangular offsets from the first, which reaches
+// every group once the count is a power of two.
+size_t firstGroup(uint64_t hash, size_t groups) {
+  return (hash >> 7) & (groups - 1);
+}
+
+} // namespace
+
+Value *Table::find(Value key) {
+  if (!normalize(key)) {
+    return nullptr;
+  }
+  size_t position = lookup(key, hashKey(key));
+  return position != capacity() ? &slots[position].value : nullptr;
+}
+
+bool Table::set(Value key, Value value) {
+  if (!normalize(key)) {
+    throw std::runtime_error("Map key can't be NaN.");
+  }
+  uint64_t hash = hashKey(key);
+  size_t position = lookup(key, hash);
+  if (position != capacity()) {
+    slots[position].value = value;
+    return false;
+  }
+  // At most seven slots in eight are full.
+  if ((count + 1) * 8 > capacity() * 7) {
+    grow();
+  }
+  position = insert(hash);
+  slots[position].key = key;
+  slots[position].value = value;
+  return true;
+}
+
+bool Table::remove(Value key) {
+  if (!normalize(key)) {
+    return false;
+  }
+  size_t position = lookup(key, hashKey(key));
+  if (position == capacity()) {
+    return false;
+  }
+  uint64_t hash = hashes[position];
+  // Retrace the insertion's path, taking the key off each full group it
+  // went past.
+  size_t groups = overflow.size();
+  size_t last = position / GROUP_SIZE;
+  for (size_t group = firstGroup(hash, groups), probe = 1; group != last;
+       group = (group + probe++) & (groups - 1)) {
+    if (overflow[group] != SATURATED) {
+      overflow[group]--;
+    }
+  }
+  control[position] = EMPTY;
+  slots[position] = Slot{};
+  count--;
+  return true;
+}
+
+size_t Table::next(size_t position) const {
+  while (position < capacity()) {
+    size_t group = position & ~(GROUP_SIZE - 1);
+    uint32_t full = ~matchEmpty(&control[group]) &
+                    (0xffffu << (position - group)) & 0xffffu;
+    if (full != 0) {
+      return group + static_cast<size_t>(__builtin_ctz(full));
+    }
+    position = group + GROUP_SIZE;
+  }
+  return capacity();
+}
+
+size_t Table::lookup(Value const &key, uint64_t hash) const {
+  size_t groups = overflow.size();
+  if (groups == 0) {
+    return capacity();
+  }
+  uint8_t byte = controlByte(hash);
+  size_t group = firstGroup(hash, groups);
+  for (size_t probe = 1; probe <= groups; probe++) {
+    uint32_t matches = matchByte(&control[group * GROUP_SIZE], byte);
+    while (matches != 0) {
+      size_t position =
+          group * GROUP_SIZE + static_cast<size_t>(__builtin_ctz(matches));
+      if (sameKey(slots[position].key, key)) {
+        return position;
+      }
+      matches &= matches - 1;
+    }
+    // No key that started at or before this group went on past it.
+    if (overflow[group] == 0) {
+      break;
+    }
+    group = (group + probe) & (groups - 1);
+  }
+  return capacity();
+}
+
+// Claims an empty slot for a new key, which the load limit guarantees.
+size_t Table::insert(uint64_t hash) {
+  size_t groups = overflow.size();
+  size_t group = firstGroup(hash, groups);
+  for (size_t probe = 1;; probe++) {
+    uint32_t empty = matchEmpty(&control[group * GROUP_SIZE]);
+    if (empty != 0) {
+      size_t position =
+          group * GROUP_SIZE + static_cast<size_t>(__builtin_ctz(empty));
+      control[position] = controlByte(hash);
+      hashes[position] = hash;
+      count++;
+      return position;
+    }
+    if (overflow[group] != SATURATED) {
+      overflow[group]++;
+    }
+    group = (group + probe) & (groups - 1);
+  }
+}
+
+// Doubles the table, placing keys by their cached hashes. The new arrays are
+// allocated before anything changes, so running out of memory leaves the
+// table as it was.
+void Table::grow() {
+  size_t newCapacity = capacity() == 0 ? GROUP_SIZE : capacity() * 2;
+  std::pmr::vector<uint8_t> oldControl(newCapacity, EMPTY,
+                                       control.get_allocator());
+  std::pmr::vector<Slot> oldSlots(newCapacity, slots.get_allocator());
+  std::pmr::vector<uint64_t> oldHashes(newCapacity, hashes.get_allocator());
+  std::pmr::vector<uint8_t> oldOverflow(newCapacity / GROUP_SIZE, 0,
+                                        overflow.get_allocator());
+  control.swap(oldControl);
+  slots.swap(oldSlots);
+  hashes.swap(oldHashes);
+  overflow.swap(oldOverflow);
+  count = 0;
+
+  for (size_t i = 0; i < oldControl.size(); i++) {
+    if (oldControl[i] != EMPTY) {
+      slots[insert(oldHashes[i])] = oldSlots[i];
+    }
+  }
+}
+
+} // namespace lox
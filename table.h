@@ -0,0 +1,82 @@
+#ifndef cpplox_table_h
+#define cpplox_table_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "value.h"
+
+namespace lox {
+
+// An open-addressing hash table from any value to any value, laid out like
+// a SwissTable. Slots hold a key and its value inline; alongside them are a
+// control byte per slot, either EMPTY or the low seven bits of the key's
+// hash, and the full hash, kept so growing never hashes a key again. Slots
+// are probed sixteen at a time: one SSE2 compare of a group's control bytes
+// finds the candidates worth comparing keys with, and a key compares in a
+// word or two, so a slot is only read when it most likely holds the key.
+//
+// Deletion leaves no tombstones. Instead each group counts the keys that
+// were inserted past it because it was full, and a lookup stops at the
+// first group on its path with no such overflow. Removing a key takes it
+// off the count of every group it passed, so a table that sees many
+// removals probes no further than one that never did.
+//
+// Keys compare as script values do: objects by identity, which for
+// interned strings is the same as by content, and numbers by value, so 1
+// and 1.0 are the same key. NaN equals nothing and can't be a key.
+class Table {
+public:
+  static constexpr size_t GROUP_SIZE = 16;
+
+  explicit Table(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : control{memory}, slots{memory}, hashes{memory}, overflow{memory} {}
+
+  size_t size() const { return count; }
+  // Positions run from 0 to capacity(); see next().
+  size_t capacity() const { return control.size(); }
+
+  // The value stored under key, or nullptr.
+  Value *find(Value key);
+  // Returns true if key wasn't there before. Throws for a NaN key.
+  bool set(Value key, Value value);
+  // Returns true if key was there.
+  bool remove(Value key);
+
+  // The position of the first entry at or after position, or capacity().
+  // Entries keep their positions until the table grows, which only an
+  // insertion of a new key can make it do.
+  size_t next(size_t position) const;
+  bool occupied(size_t position) const {
+    return position < capacity() && control[position] != EMPTY;
+  }
+  Value const &keyAt(size_t position) const { return slots[position].key; }
+  Value &valueAt(size_t position) { return slots[position].value; }
+
+private:
+  static constexpr uint8_t EMPTY = 0x80;
+  // Overflow counts stick here and stop being maintained.
+  static constexpr uint8_t SATURATED = UINT8_MAX;
+
+  struct Slot {
+    Value key;
+    Value value;
+  };
+
+  std::pmr::vector<uint8_t> control;
+  std::pmr::vector<Slot> slots;
+  std::pmr::vector<uint64_t> hashes;
+  std::pmr::vector<uint8_t> overflow;
+  size_t count = 0;
+
+  size_t lookup(Value const &key, uint64_t hash) const;
+  size_t insert(uint64_t hash);
+  void grow();
+};
+
+} // namespace lox
+
+#endif
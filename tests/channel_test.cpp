@@ -0,0 +1,89 @@
+// Channels used from a single VM fail instead of waiting forever, and a VM
+// that waits on a channel has flushed what it printed before it started.
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "../channel.h"
+#include "../vm.h"
+
+namespace {
+
+int failures = 0;
+
+void expectRun(std::string const &source, lox::InterpretResult expected,
+               std::string const &output) {
+  lox::VM vm;
+  vm.setOutput(lox::OutputSink::memory());
+  lox::InterpretResult result = vm.interpret(source);
+  if (result != expected || vm.output().contents() != output) {
+    std::fprintf(stderr, "%s: expected %d and %s, got %d and %s\n",
+                 source.c_str(), expected, output.c_str(), result,
+                 vm.output().contents().c_str());
+    failures++;
+  }
+}
+
+// The script prints, then waits for a message that the host only sends
+// once it has read what was printed.
+void expectFlushedBeforeWaiting() {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    std::perror("pipe");
+    failures++;
+    return;
+  }
+  auto channel = std::make_shared<lox::Channel>(2);
+  std::thread script([&] {
+    lox::VM vm;
+    vm.setOutput(lox::OutputSink(fds[1]));
+    vm.defineChannel("jobs", channel);
+    vm.interpret("print \"ready\"; print channelReceive(jobs);");
+    close(fds[1]);
+  });
+
+  char ready[6] = {};
+  for (size_t got = 0; got < sizeof(ready);) {
+    ssize_t n = read(fds[0], ready + got, sizeof(ready) - got);
+    if (n <= 0) {
+      break;
+    }
+    got += static_cast<size_t>(n);
+  }
+  channel->send(42.0);
+  script.join();
+
+  std::string rest;
+  char buffer[64];
+  for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) {
+    rest.append(buffer, static_cast<size_t>(n));
+  }
+  close(fds[0]);
+  if (std::string(ready, sizeof(ready)) != "ready\n" || rest != "42\n") {
+    std::fprintf(stderr, "waiting VM: expected ready and 42, got %.6s%s\n",
+                 ready, rest.c_str());
+    failures++;
+  }
+}
+
+} // namespace
+
+int main() {
+  expectRun("print 1; var c = channel(1); channelReceive(c); print 2;",
+            lox::INTERPRET_RUNTIME_ERROR, "1\n");
+  expectRun("var c = channel(2); channelSend(c, 1); channelSend(c, 2);"
+            "print 3; channelSend(c, 3);",
+            lox::INTERPRET_RUNTIME_ERROR, "3\n");
+  expectRun("var c = channel(2); channelSend(c, 1); channelSend(c, 2);"
+            "print channelTrySend(c, 3); print channelReceive(c);"
+            "print channelTryReceive(c); print channelTryReceive(c);",
+            lox::INTERPRET_OK, "false\n1\n2\nnil\n");
+  expectRun("var c = channel(1); channelSend(c, 1); channelClose(c);"
+            "print channelReceive(c); print channelReceive(c);",
+            lox::INTERPRET_OK, "1\nnil\n");
+  expectFlushedBeforeWaiting();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+// Name resolution: a function can't reach the locals of anything that
+// encloses it, the script's blocks included, and says so at compile time
+// rather than falling back to a global of the same name.
+#include <cstdio>
+#include <string>
+
+#include "../vm.h"
+
+namespace {
+
+int failures = 0;
+
+void expectRun(std::string const &source, lox::InterpretResult expected,
+               std::string const &output) {
+  lox::VM vm;
+  vm.setOutput(lox::OutputSink::memory());
+  lox::InterpretResult result = vm.interpret(source);
+  if (result != expected || vm.output().contents() != output) {
+    std::fprintf(stderr, "%s: expected %d and %s, got %d and %s\n",
+                 source.c_str(), expected, output.c_str(), result,
+                 vm.output().contents().c_str());
+    failures++;
+  }
+}
+
+} // namespace
+
+int main() {
+  expectRun("var a = \"global\";"
+            "{ var a = \"block\"; fun f() { print a; } f(); }",
+            lox::INTERPRET_COMPILE_ERROR, "");
+  expectRun("{ var a = 1; fun f() { a = 2; } }", lox::INTERPRET_COMPILE_ERROR,
+            "");
+  expectRun("fun outer() { var a = 1; fun inner() { print a; } inner(); }"
+            "outer();",
+            lox::INTERPRET_COMPILE_ERROR, "");
+  expectRun("var a = \"global\"; { fun f() { print a; } f(); }",
+            lox::INTERPRET_OK, "global\n");
+  expectRun("{ var a = 1; } fun f() { print a; } var a = 2; f();",
+            lox::INTERPRET_OK, "2\n");
+  expectRun("{ fun f(a) { { var b = a + 1; print b; } } f(1); }",
+            lox::INTERPRET_OK, "2\n");
+  return failures == 0 ? 0 : 1;
+}
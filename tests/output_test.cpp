@@ -0,0 +1,98 @@
+// How numbers print: integers and whole doubles in full, everything else
+// in the shortest form that reads back as the same double. And when a
+// line-buffered sink passes output on.
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../output.h"
+#include "../vm.h"
+
+namespace {
+
+int failures = 0;
+
+void expectNumber(double value, std::string const &expected) {
+  lox::OutputSink out = lox::OutputSink::memory();
+  out.writeNumber(value);
+  if (out.contents() != expected) {
+    std::fprintf(stderr, "writeNumber: expected %s, got %s\n",
+                 expected.c_str(), out.contents().c_str());
+    failures++;
+  }
+}
+
+// Integers go through the integer path, not via double.
+void expectPrinted(std::string const &source, std::string const &expected) {
+  lox::VM vm;
+  vm.setOutput(lox::OutputSink::memory());
+  vm.interpret(source);
+  if (vm.output().contents() != expected) {
+    std::fprintf(stderr, "%s: expected %s, got %s\n", source.c_str(),
+                 expected.c_str(), vm.output().contents().c_str());
+    failures++;
+  }
+}
+
+// What a reader of fd has been sent so far.
+std::string available(int fd) {
+  std::string text;
+  char buffer[64];
+  for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) {
+    text.append(buffer, static_cast<size_t>(n));
+  }
+  return text;
+}
+
+// A line-buffered sink holds a partial line and passes on complete ones.
+void expectLineBuffered() {
+  int fds[2];
+  if (pipe2(fds, O_NONBLOCK) != 0) {
+    std::perror("pipe2");
+    failures++;
+    return;
+  }
+  {
+    lox::OutputSink out{fds[1]};
+    out.setLineBuffered(true);
+    out.write("partial");
+    std::string before = available(fds[0]);
+    out.put('\n');
+    out.write("two\nlines\n");
+    out.write("tail");
+    std::string after = available(fds[0]);
+    if (before != "" || after != "partial\ntwo\nlines\n") {
+      std::fprintf(stderr, "line buffering: got %s then %s\n", before.c_str(),
+                   after.c_str());
+      failures++;
+    }
+  }
+  close(fds[1]);
+  close(fds[0]);
+}
+
+} // namespace
+
+int main() {
+  expectNumber(0, "0");
+  expectNumber(-0.0, "-0");
+  expectNumber(7, "7");
+  expectNumber(100000, "100000");
+  expectNumber(1000000, "1000000");
+  expectNumber(-123456789, "-123456789");
+  expectNumber(9007199254740992.0, "9007199254740992");
+  expectNumber(0.5, "0.5");
+  expectNumber(0.1 + 0.2, "0.30000000000000004");
+  expectNumber(1e300, "1e+300");
+  expectNumber(1e-7, "1e-07");
+
+  expectPrinted("print 99999 + 1;", "100000\n");
+  expectPrinted("print 9007199254740992;", "9007199254740992\n");
+  expectPrinted("print -7 * 3;", "-21\n");
+  expectPrinted("print 0 * -1;", "-0\n");
+
+  expectLineBuffered();
+  return failures == 0 ? 0 : 1;
+}
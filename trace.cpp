@@ -0,0 +1,306 @@
+#include "trace.h"
+
+#include <algorithm>
+
+namespace lox {
+
+namespace {
+
+class TraceCompiler {
+public:
+  TraceCompiler(Chunk &chunk, std::vector<RecordedInstruction> const &path)
+      : chunk{chunk}, path{path} {}
+
+  bool run();
+
+  std::vector<TraceInstruction> code;
+
+private:
+  // A load of a local or literal that hasn't been pushed, and where the
+  // interpreter would have pushed it.
+  struct Pending {
+    Operand operand;
+    uint32_t offset;
+  };
+
+  Chunk &chunk;
+  std::vector<RecordedInstruction> const &path;
+  std::vector<Pending> pending;
+  size_t next = 0;
+
+  static TraceInstruction make(TraceOp op) {
+    TraceInstruction instruction;
+    instruction.op = op;
+    return instruction;
+  }
+  uint8_t byteAt(uint32_t offset) const { return chunk.codes[offset]; }
+  uint16_t shortAt(uint32_t offset) const {
+    return static_cast<uint16_t>((chunk.codes[offset] << 8) |
+                                 chunk.codes[offset + 1]);
+  }
+  uint8_t peekOp(size_t ahead) const {
+    size_t index = next + ahead;
+    return index < path.size() ? byteAt(path[index].offset)
+                               : static_cast<uint8_t>(OP_RETURN);
+  }
+
+  void load(OperandKind kind, uint16_t index, uint32_t offset) {
+    pending.push_back(Pending{Operand{kind, index}, offset});
+  }
+  void flush();
+  uint32_t take(Operand *operands, size_t count, uint32_t offset);
+  bool fuseBranch(TraceInstruction &instruction);
+  bool fusePop();
+};
+
+void TraceCompiler::flush() {
+  for (Pending const &load : pending) {
+    TraceInstruction push = make(TraceOp::PUSH);
+    push.a = load.operand;
+    code.push_back(push);
+  }
+  pending.clear();
+}
+
+// Hands the top count values to the instruction at offset, folding pending
+// loads in as operands. Loads still pending beneath them are pushed first,
+// so a side exit to the earliest folded load finds the stack exactly as the
+// interpreter would have it there. Returns that exit offset.
+uint32_t TraceCompiler::take(Operand *operands, size_t count,
+                             uint32_t offset) {
+  size_t folded = std::min(count, pending.size());
+  size_t below = pending.size() - folded;
+  for (size_t i = 0; i < below; i++) {
+    TraceInstruction push = make(TraceOp::PUSH);
+    push.a = pending[i].operand;
+    code.push_back(push);
+  }
+  pending.erase(pending.begin(), pending.begin() + below);
+
+  uint32_t exit = offset;
+  for (size_t i = count; i-- > 0;) {
+    if (pending.empty()) {
+      operands[i] = Operand{};
+    } else {
+      operands[i] = pending.back().operand;
+      exit = pending.back().offset;
+      pending.pop_back();
+    }
+  }
+  return exit;
+}
+
+// Folds a following OP_JUMP_IF_FALSE and the OP_POP after it, whichever way
+// the jump went, into a guard on the recorded direction.
+bool TraceCompiler::fuseBranch(TraceInstruction &instruction) {
+  if (peekOp(0) != OP_JUMP_IF_FALSE || peekOp(1) != OP_POP) {
+    return false;
+  }
+  instruction.branch = path[next].taken ? TraceBranch::ExpectFalse
+                                        : TraceBranch::ExpectTrue;
+  next += 2;
+  return true;
+}
+
+bool TraceCompiler::fusePop() {
+  if (peekOp(0) != OP_POP) {
+    return false;
+  }
+  next++;
+  return true;
+}
+
+bool TraceCompiler::run() {
+  while (next < path.size()) {
+    RecordedInstruction const &recorded = path[next++];
+    uint32_t offset = recorded.offset;
+    uint8_t op = byteAt(offset);
+
+    switch (op) {
+    case OP_CONSTANT:
+      load(OperandKind::Constant, byteAt(offset + 1), offset);
+      break;
+    case OP_NIL:
+      load(OperandKind::Nil, 0, offset);
+      break;
+    case OP_TRUE:
+      load(OperandKind::True, 0, offset);
+      break;
+    case OP_FALSE:
+      load(OperandKind::False, 0, offset);
+      break;
+    case OP_GET_LOCAL:
+      load(OperandKind::Local, byteAt(offset + 1), offset);
+      break;
+    case OP_GET_LOCAL_LONG:
+      load(OperandKind::Local, shortAt(offset + 1), offset);
+      break;
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_LONG: {
+      TraceInstruction store = make(TraceOp::SET_LOCAL);
+      store.index =
+          op == OP_SET_LOCAL ? byteAt(offset + 1) : shortAt(offset + 1);
+      // Nothing is left pending afterwards, so no folded load can read the
+      // local's old value.
+      take(&store.a, 1, offset);
+      store.pop = fusePop();
+      code.push_back(store);
+      break;
+    }
+    case OP_GET_GLOBAL: {
+      flush();
+      TraceInstruction get = make(TraceOp::GET_GLOBAL);
+      get.index = shortAt(offset + 1);
+      get.exit = offset;
+      code.push_back(get);
+      break;
+    }
+    case OP_SET_GLOBAL: {
+      TraceInstruction set = make(TraceOp::SET_GLOBAL);
+      set.index = shortAt(offset + 1);
+      set.exit = take(&set.a, 1, offset);
+      set.pop = fusePop();
+      code.push_back(set);
+      break;
+    }
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_EQUAL: {
+      if (op != OP_EQUAL && !recorded.numeric) {
+        return false;
+      }
+      TraceOp traceOp = op == OP_ADD        ? TraceOp::ADD
+                        : op == OP_SUBTRACT ? TraceOp::SUBTRACT
+                        : op == OP_MULTIPLY ? TraceOp::MULTIPLY
+                        : op == OP_DIVIDE   ? TraceOp::DIVIDE
+                        : op == OP_LESS     ? TraceOp::LESS
+                        : op == OP_GREATER  ? TraceOp::GREATER
+                                            : TraceOp::EQUAL;
+      TraceInstruction binary = make(traceOp);
+      Operand operands[2];
+      binary.exit = take(operands, 2, offset);
+      binary.a = operands[0];
+      binary.b = operands[1];
+      if (op == OP_LESS || op == OP_GREATER || op == OP_EQUAL) {
+        fuseBranch(binary);
+      }
+      code.push_back(binary);
+      break;
+    }
+    case OP_NOT:
+    case OP_NEGATE: {
+      if (op == OP_NEGATE && !recorded.numeric) {
+        return false;
+      }
+      TraceInstruction unary =
+          make(op == OP_NOT ? TraceOp::NOT : TraceOp::NEGATE);
+      unary.exit = take(&unary.a, 1, offset);
+      code.push_back(unary);
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      TraceInstruction guard = make(TraceOp::GUARD);
+      guard.branch = recorded.taken ? TraceBranch::ExpectFalse
+                                    : TraceBranch::ExpectTrue;
+      guard.exit = take(&guard.a, 1, offset);
+      guard.pop = fusePop();
+      code.push_back(guard);
+      break;
+    }
+    case OP_JUMP:
+      // The trace simply continues along the recorded path.
+      break;
+    case OP_POP:
+    case OP_POPN: {
+      size_t count = op == OP_POP ? 1 : byteAt(offset + 1);
+      // Discarding a load that was never pushed costs nothing.
+      while (count > 0 && !pending.empty()) {
+        pending.pop_back();
+        count--;
+      }
+      if (count > 0) {
+        TraceInstruction pop = make(TraceOp::POPN);
+        pop.index = static_cast<uint16_t>(count);
+        code.push_back(pop);
+      }
+      break;
+    }
+    case OP_PRINT: {
+      TraceInstruction print = make(TraceOp::PRINT);
+      take(&print.a, 1, offset);
+      code.push_back(print);
+      break;
+    }
+    case OP_LOOP: {
+      if (next != path.size()) {
+        // A back edge other than the one closing the trace is just a jump.
+        break;
+      }
+      flush();
+      TraceInstruction loop = make(TraceOp::LOOP);
+      loop.exit = path.front().offset;
+      code.push_back(loop);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  return !code.empty() && code.back().op == TraceOp::LOOP;
+}
+
+} // namespace
+
+bool isTraceable(uint8_t opcode) {
+  switch (opcode) {
+  case OP_CONSTANT:
+  case OP_NIL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_PRINT:
+  case OP_POP:
+  case OP_POPN:
+  case OP_GET_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_GET_LOCAL_LONG:
+  case OP_SET_LOCAL_LONG:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool compileTrace(Chunk &chunk, std::vector<RecordedInstruction> const &path,
+                  LoopSite &site) {
+  TraceCompiler compiler{chunk, path};
+  if (!compiler.run()) {
+    return false;
+  }
+
+  site.traceStart = static_cast<uint32_t>(chunk.traces.size());
+  site.traceLength = static_cast<uint32_t>(compiler.code.size());
+  site.instructionCount = static_cast<uint32_t>(path.size());
+  chunk.traces.insert(chunk.traces.end(), compiler.code.begin(),
+                      compiler.code.end());
+  return true;
+}
+
+} // namespace lox
@@ -0,0 +1,34 @@
+#ifndef cpplox_trace_h
+#define cpplox_trace_h
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.h"
+
+namespace lox {
+
+// One bytecode instruction executed while recording a hot loop, with what
+// it observed.
+struct RecordedInstruction {
+  uint32_t offset;
+  // The operands of an arithmetic instruction or comparison were numbers.
+  bool numeric = false;
+  // An OP_JUMP_IF_FALSE took its jump.
+  bool taken = false;
+};
+
+// Whether the trace interpreter handles this opcode. Recording stops before
+// anything else, such as calls and property accesses.
+bool isTraceable(uint8_t opcode);
+
+// Translates one recorded trip around a loop, ending with its OP_LOOP, into
+// trace instructions appended to chunk.traces and attaches them to site.
+// Returns false and leaves the chunk alone if the path can't be specialized,
+// for example because it added strings.
+bool compileTrace(Chunk &chunk, std::vector<RecordedInstruction> const &path,
+                  LoopSite &site);
+
+} // namespace lox
+
+#endif
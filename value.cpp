@@ -1,15 +1,21 @@
 #include "value.h"
+#include "object.h"
 
-#include <iostream>
 #include <variant>
 
 namespace lox {
 struct Printer {
-  void operator()(double value) const { std::cout << value; }
-  void operator()(bool value) const { std::cout << (value ? "true" : "false"); }
-  void operator()(Nil) const { std::cout << "nil"; }
+  OutputSink &out;
+
+  void operator()(double value) const { out.writeNumber(value); }
+  void operator()(int64_t value) const { out.writeInteger(value); }
+  void operator()(bool value) const { out.write(value ? "true" : "false"); }
+  void operator()(Nil) const { out.write("nil"); }
+  void operator()(Object *value) const { printObject(out, value); }
 };
 
-void printValue(Value value) { std::visit(Printer{}, value); }
+void printValue(OutputSink &out, Value value) {
+  std::visit(Printer{out}, value);
+}
 
 } // namespace lox
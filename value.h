@@ -1,9 +1,13 @@
 #ifndef cpplox_value_h
 #define cpplox_value_h
 
+#include <cstdint>
+#include <memory_resource>
 #include <variant>
 #include <vector>
 
+#include "output.h"
+
 namespace lox {
 class Object;
 class Nil {};
@@ -12,22 +16,26 @@ enum class ValueType {
   Bool,
   Nil,
   Number,
+  Object,
 };
 
-using Value = std::variant<double, bool, Nil>;
-using ValueArray = std::vector<Value>;
+// An int64_t is a number too; see number.h.
+using Value = std::variant<double, bool, Nil, Object *, int64_t>;
+using ValueArray = std::pmr::vector<Value>;
 
 struct TypeVisitor {
   ValueType operator()(double) { return ValueType::Number; }
+  ValueType operator()(int64_t) { return ValueType::Number; }
   ValueType operator()(bool) { return ValueType::Bool; }
   ValueType operator()(Nil) { return ValueType::Nil; }
+  ValueType operator()(Object *) { return ValueType::Object; }
 };
 
 inline ValueType getType(Value value) {
   return std::visit(TypeVisitor{}, value);
 }
 
-void printValue(Value);
+void printValue(OutputSink &out, Value);
 } // namespace lox
 
 #endif
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "verifier.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "object.h"
+
+namespace lox {
+
+namespace {
+
+constexpr int UNVISITED = -1;
+
+// How control reaches an instruction.
+enum Entry : uint8_t {
+  // Falling through from an OP_CONSTANT that loads a function.
+  AFTER_FUNCTION = 1,
+  // Any other way.
+  OTHERWISE = 2,
+};
+
+class Verifier {
+public:
+  Verifier(Chunk &chunk, int arity, size_t globalCount)
+      : chunk{chunk}, globalCount{globalCount},
+        depths(chunk.codes.size(), UNVISITED), entries(chunk.codes.size()) {
+    // Slot zero (the callee or receiver) and the parameters.
+    maxDepth = arity + 1;
+    enqueue(0, arity + 1);
+  }
+
+  size_t run() {
+    while (!worklist.empty()) {
+      size_t offset = worklist.back();
+      worklist.pop_back();
+      step(offset);
+    }
+    // OP_METHOD takes its method off the stack, so it must only be reachable
+    // straight after the function is loaded.
+    for (size_t offset = 0; offset < chunk.codes.size(); offset++) {
+      if (depths[offset] != UNVISITED && chunk.codes[offset] == OP_METHOD &&
+          entries[offset] != AFTER_FUNCTION) {
+        fail(offset, "Method is not a function constant");
+      }
+    }
+    return maxDepth;
+  }
+
+private:
+  Chunk &chunk;
+  size_t globalCount;
+  std::vector<int> depths;
+  std::vector<uint8_t> entries;
+  std::vector<size_t> worklist;
+  size_t maxDepth = 0;
+
+  [[noreturn]] void fail(size_t offset, std::string const &message) {
+    throw VerifyError(message + " at offset " + std::to_string(offset) + ".");
+  }
+
+  void enqueue(size_t offset, int depth, Entry entry = OTHERWISE) {
+    if (offset >= chunk.codes.size()) {
+      fail(offset, "Control falls off the end of the chunk");
+    }
+    entries[offset] |= entry;
+    if (depths[offset] == UNVISITED) {
+      depths[offset] = depth;
+      worklist.push_back(offset);
+    } else if (depths[offset] != depth) {
+      fail(offset, "Inconsistent stack depth");
+    }
+  }
+
+  uint8_t byteOperand(size_t offset, size_t index) {
+    if (offset + index >= chunk.codes.size()) {
+      fail(offset, "Truncated operand");
+    }
+    return chunk.codes[offset + index];
+  }
+
+  uint16_t shortOperand(size_t offset, size_t index) {
+    return static_cast<uint16_t>((byteOperand(offset, index) << 8) |
+                                 byteOperand(offset, index + 1));
+  }
+
+  void checkConstant(size_t offset, uint8_t index) {
+    if (index >= chunk.constants.size()) {
+      fail(offset, "Constant index out of range");
+    }
+  }
+
+  void checkName(size_t offset, uint8_t index) {
+    checkConstant(offset, index);
+    if (!isString(chunk.constants[index])) {
+      fail(offset, "Name operand is not a string constant");
+    }
+  }
+
+  void checkCache(size_t offset, uint16_t index) {
+    if (index >= chunk.caches.size()) {
+      fail(offset, "Inline cache index out of range");
+    }
+  }
+
+  void checkGlobal(size_t offset, uint16_t index) {
+    if (index >= globalCount) {
+      fail(offset, "Global index out of range");
+    }
+  }
+
+  void checkLocal(size_t offset, int depth, uint16_t slot) {
+    if (slot >= depth) {
+      fail(offset, "Local slot outside the frame");
+    }
+  }
+
+  // Applies an instruction's stack effect: it needs `pops` values and
+  // leaves `pushes` in their place.
+  int effect(size_t offset, int depth, int pops, int pushes) {
+    if (depth < pops) {
+      fail(offset, "Stack underflow");
+    }
+    depth += pushes - pops;
+    if (static_cast<size_t>(depth) > maxDepth) {
+      maxDepth = depth;
+    }
+    return depth;
+  }
+
+  void step(size_t offset) {
+    int depth = depths[offset];
+    size_t next = offset + 1;
+    Entry entry = OTHERWISE;
+
+    switch (chunk.codes[offset]) {
+    case OP_CONSTANT: {
+      uint8_t index = byteOperand(offset, 1);
+      checkConstant(offset, index);
+      if (isFunction(chunk.constants[index])) {
+        entry = AFTER_FUNCTION;
+      }
+      depth = effect(offset, depth, 0, 1);
+      next = offset + 2;
+      break;
+    }
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+      depth = effect(offset, depth, 0, 1);
+      break;
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      depth = effect(offset, depth, 2, 1);
+      break;
+    case OP_NOT:
+    case OP_NEGATE:
+      depth = effect(offset, depth, 1, 1);
+      break;
+    case OP_PRINT:
+    case OP_POP:
+      depth = effect(offset, depth, 1, 0);
+      break;
+    case OP_POPN:
+      depth = effect(offset, depth, byteOperand(offset, 1), 0);
+      next = offset + 2;
+      break;
+    case OP_DEFINE_GLOBAL:
+      checkGlobal(offset, shortOperand(offset, 1));
+      depth = effect(offset, depth, 1, 0);
+      next = offset + 3;
+      break;
+    case OP_GET_GLOBAL:
+      checkGlobal(offset, shortOperand(offset, 1));
+      depth = effect(offset, depth, 0, 1);
+      next = offset + 3;
+      break;
+    case OP_SET_GLOBAL:
+      checkGlobal(offset, shortOperand(offset, 1));
+      depth = effect(offset, depth, 1, 1);
+      next = offset + 3;
+      break;
+    case OP_GET_LOCAL:
+      checkLocal(offset, depth, byteOperand(offset, 1));
+      depth = effect(offset, depth, 0, 1);
+      next = offset + 2;
+      break;
+    case OP_SET_LOCAL:
+      checkLocal(offset, depth, byteOperand(offset, 1));
+      depth = effect(offset, depth, 1, 1);
+      next = offset + 2;
+      break;
+    case OP_GET_LOCAL_LONG:
+      checkLocal(offset, depth, shortOperand(offset, 1));
+      depth = effect(offset, depth, 0, 1);
+      next = offset + 3;
+      break;
+    case OP_SET_LOCAL_LONG:
+      checkLocal(offset, depth, shortOperand(offset, 1));
+      depth = effect(offset, depth, 1, 1);
+      next = offset + 3;
+      break;
+    case OP_JUMP:
+      enqueue(offset + 3 + shortOperand(offset, 1), depth);
+      return;
+    case OP_JUMP_IF_FALSE:
+      // Tests the top of the stack without popping it.
+      depth = effect(offset, depth, 1, 1);
+      enqueue(offset + 3 + shortOperand(offset, 1), depth);
+      next = offset + 3;
+      break;
+    case OP_LOOP: {
+      uint16_t distance = shortOperand(offset, 1);
+      if (distance > offset + 5) {
+        fail(offset, "Loop jumps before the start of the chunk");
+      }
+      if (shortOperand(offset, 3) >= chunk.loops.size()) {
+        fail(offset, "Loop site index out of range");
+      }
+      enqueue(offset + 5 - distance, depth);
+      return;
+    }
+    case OP_CALL:
+    case OP_TAIL_CALL:
+      depth = effect(offset, depth, byteOperand(offset, 1) + 1, 1);
+      next = offset + 2;
+      break;
+    case OP_CLASS:
+      checkName(offset, byteOperand(offset, 1));
+      depth = effect(offset, depth, 0, 1);
+      next = offset + 2;
+      break;
+    case OP_METHOD:
+      checkName(offset, byteOperand(offset, 1));
+      depth = effect(offset, depth, 2, 1);
+      next = offset + 2;
+      break;
+    case OP_GET_PROPERTY:
+      checkName(offset, byteOperand(offset, 1));
+      checkCache(offset, shortOperand(offset, 2));
+      depth = effect(offset, depth, 1, 1);
+      next = offset + 4;
+      break;
+    case OP_SET_PROPERTY:
+      checkName(offset, byteOperand(offset, 1));
+      checkCache(offset, shortOperand(offset, 2));
+      depth = effect(offset, depth, 2, 1);
+      next = offset + 4;
+      break;
+    case OP_INVOKE:
+      checkName(offset, byteOperand(offset, 1));
+      checkCache(offset, shortOperand(offset, 3));
+      depth = effect(offset, depth, byteOperand(offset, 2) + 1, 1);
+      next = offset + 5;
+      break;
+    case OP_RETURN:
+      effect(offset, depth, 1, 0);
+      return;
+    default:
+      fail(offset, "Unknown opcode " + std::to_string(chunk.codes[offset]));
+    }
+
+    enqueue(next, depth, entry);
+  }
+};
+
+} // namespace
+
+void verifyChunk(Chunk &chunk, int arity, size_t globalCount) {
+  chunk.maxStack = Verifier{chunk, arity, globalCount}.run();
+  chunk.verified = true;
+}
+
+void verifyFunction(ObjFunction *function, size_t globalCount) {
+  // Lazy functions are verified once their body is compiled.
+  if (function->chunk.verified || function->lazy != nullptr) {
+    return;
+  }
+
+  try {
+    verifyChunk(function->chunk, function->arity, globalCount);
+  } catch (VerifyError const &error) {
+    std::string name{function->name.empty() ? "script" : function->name};
+    throw VerifyError("Invalid bytecode in " + name + ": " + error.what());
+  }
+
+  for (Value const &constant : function->chunk.constants) {
+    if (isFunction(constant)) {
+      verifyFunction(asFunction(constant), globalCount);
+    }
+  }
+}
+
+} // namespace lox
@@ -0,0 +1,33 @@
+#ifndef cpplox_verifier_h
+#define cpplox_verifier_h
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include "chunk.h"
+
+namespace lox {
+class ObjFunction;
+
+class VerifyError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Checks a chunk once before it runs: every opcode is known, operands stay
+// inside the code, constant, cache, global and local indices are in range,
+// and every path ends in a return. The stack depth at each instruction is
+// found by abstract interpretation; the maximum is stored in
+// chunk.maxStack so the VM can reserve a frame's stack space once per call
+// and run without per-instruction bounds checks.
+//
+// Throws VerifyError describing the first problem found.
+void verifyChunk(Chunk &chunk, int arity, size_t globalCount);
+
+// Verifies function and, recursively, every function in its constant pool.
+void verifyFunction(ObjFunction *function, size_t globalCount);
+
+} // namespace lox
+
+#endif
@@ -1,54 +1,552 @@
 #include "vm.h"
+#include "array.h"
+#include "channel.h"
 #include "chunk.h"
 #include "compiler.h"
 #include "debug.h"
+#include "lazy.h"
+#include "map.h"
 #include "value.h"
+#include "trace.h"
+#include "verifier.h"
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <deque>
+#include <ctime>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <stack>
 #include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <valarray>
 #include <variant>
 
 namespace lox {
 
-InterpretResult VM::interpret(std::string const &src) {
-  Parser parser{};
-  Chunk chunk{};
+namespace {
 
-  if (!parser.compile(src, chunk)) {
+double clockNative() {
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+} // namespace
+
+VM::VM(size_t maxFrames)
+    : pool{&memory}, frames(maxFrames, std::pmr::new_delete_resource()),
+      stack(std::pmr::new_delete_resource()), heap{&pool}, globals{&memory} {
+  this->stack.resize(maxFrames * (UINT8_MAX + 1));
+  this->stackTop = this->stack.data();
+  this->initString = heap.intern("init");
+  defineNative("clock", clockNative);
+  defineArrayNatives(*this);
+  defineChannelNatives(*this);
+  defineMapNatives(*this);
+}
+
+InterpretResult VM::interpret(std::string const &src, size_t budget) {
+  ObjFunction *function;
+  try {
+    function = compile(src);
+  } catch (MemoryLimitError &e) {
+    out.flush();
+    std::cerr << e.what() << "\n";
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  if (function == nullptr) {
     return INTERPRET_COMPILE_ERROR;
   }
+  return interpret(function, budget);
+}
+
+ObjFunction *VM::compile(std::string const &src) {
+  Parser parser{globals, heap, out, lazyCompilation};
+  ObjFunction *function = parser.compile(src);
+  if (function != nullptr) {
+    try {
+      verifyFunction(function, globals.size());
+    } catch (VerifyError &e) {
+      out.flush();
+      std::cerr << e.what() << "\n";
+      return nullptr;
+    }
+  }
+  out.flush();
+  return function;
+}
+
+void VM::compileFunctions(ObjFunction *script) {
+  std::vector<ObjFunction *> pending{script};
+  while (!pending.empty()) {
+    ObjFunction *function = pending.back();
+    pending.pop_back();
+    if (function->lazy != nullptr) {
+      compileLazy(function, globals, heap, out);
+    }
+    for (Value const &constant : function->chunk.constants) {
+      if (isFunction(constant)) {
+        pending.push_back(asFunction(constant));
+      }
+    }
+  }
+}
+
+InterpretResult VM::interpret(ObjFunction *function, size_t budget) {
+  resetStack();
+  push(function);
+  try {
+    call(function, 0);
+  } catch (std::runtime_error &e) {
+    runtimeError(e.what());
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  return resume(budget);
+}
+
+InterpretResult VM::resume(size_t budget) {
+  if (!suspended()) {
+    return INTERPRET_OK;
+  }
+
+  this->budget = budget;
+  InterpretResult result = run();
+  out.flush();
+  return result;
+}
+
+void VM::setOutput(OutputSink sink) {
+  out.flush();
+  out = std::move(sink);
+}
+
+void VM::callValue(Value callee, int argCount) {
+  if (isFunction(callee)) {
+    return call(asFunction(callee), argCount);
+  }
+
+  if (isNative(callee)) {
+    return callNative(asNative(callee), argCount);
+  }
 
-  this->chunk = std::move(chunk);
-  ip = this->chunk.codes.data();
+  if (isBoundMethod(callee)) {
+    ObjBoundMethod *bound = asBoundMethod(callee);
+    this->stackTop[-argCount - 1] = bound->receiver;
+    return call(bound->method, argCount);
+  }
 
-  return run();
+  if (isClass(callee)) {
+    ObjClass *klass = asClass(callee);
+    this->stackTop[-argCount - 1] = heap.allocate<ObjInstance>(klass);
+    if (klass->initializer != nullptr) {
+      return call(klass->initializer, argCount);
+    }
+    if (argCount != 0) {
+      throw std::runtime_error("Expected 0 arguments but got " +
+                               std::to_string(argCount) + ".");
+    }
+    return;
+  }
+
+  throw std::runtime_error("Can only call functions and classes.");
+}
+
+void VM::call(ObjFunction *function, int argCount) {
+  if (argCount != function->arity) {
+    throw std::runtime_error("Expected " + std::to_string(function->arity) +
+                             " arguments but got " +
+                             std::to_string(argCount) + ".");
+  }
+
+  if (function->lazy != nullptr) {
+    compileLazy(function, globals, heap, out);
+  }
+
+  Value *slots = this->stackTop - argCount - 1;
+  if (this->frameCount == this->frames.size() ||
+      !stackFits(slots, function)) {
+    throw std::runtime_error("Stack overflow.");
+  }
+
+  // Fill in the new frame before publishing it through frameCount; the
+  // profiler may sample at any instruction.
+  CallFrame &next = this->frames[this->frameCount];
+  next.function = function;
+  next.slots = slots;
+  if (this->frame != nullptr) {
+    this->frame->ip = this->ip;
+  }
+  this->frame = &next;
+  this->ip = function->chunk.codes.data();
+  // A compiler fence is enough: the handler runs on this thread.
+  std::atomic_signal_fence(std::memory_order_release);
+  this->frameCount++;
+}
+
+// Natives run on the caller's stack: the thunk reads the arguments in
+// place and the result replaces the callee and its arguments. No frame is
+// pushed, so a native never shows up in a stack trace.
+void VM::callNative(ObjNative *native, int argCount) {
+  if (argCount != native->arity) {
+    throw std::runtime_error("Expected " + std::to_string(native->arity) +
+                             " arguments but got " +
+                             std::to_string(argCount) + ".");
+  }
+
+  Value result;
+  try {
+    result = native->thunk(*this, heap, native, this->stackTop - argCount);
+  } catch (std::bad_alloc &) {
+    // Containers a native builds can outgrow the machine, not just the
+    // heap limit.
+    throw std::runtime_error("Out of memory.");
+  } catch (std::length_error &) {
+    throw std::runtime_error("Out of memory.");
+  }
+  this->stackTop -= argCount + 1;
+  push(result);
+}
+
+void VM::bindNative(std::string_view name, size_t arity, NativeThunk thunk,
+                    void (*function)()) {
+  ObjString *interned = heap.intern(name);
+  Global &global = globals[globals.resolve(interned)];
+  global.value = heap.allocate<ObjNative>(interned, static_cast<int>(arity),
+                                          thunk, function);
+  global.defined = true;
+}
+
+void VM::defineChannel(std::string_view name,
+                       std::shared_ptr<Channel> channel) {
+  ObjString *interned = heap.intern(name);
+  Global &global = globals[globals.resolve(interned)];
+  global.value = heap.allocate<ObjChannel>(std::move(channel));
+  global.defined = true;
+}
+
+// The one bounds check per call that stands in for checks on every push.
+bool VM::stackFits(Value *slots, ObjFunction *function) {
+  size_t available = this->stack.data() + this->stack.size() - slots;
+  return function->chunk.maxStack <= available;
+}
+
+// Replaces the running frame with the callee instead of pushing a new one.
+// The callee and its arguments slide down over the caller's slots.
+void VM::tailCall(int argCount) {
+  Value callee = peek(argCount);
+  if (!isFunction(callee) || asFunction(callee)->arity != argCount) {
+    return callValue(callee, argCount);
+  }
+
+  ObjFunction *function = asFunction(callee);
+  if (function->lazy != nullptr) {
+    compileLazy(function, globals, heap, out);
+  }
+  if (!stackFits(frame->slots, function)) {
+    throw std::runtime_error("Stack overflow.");
+  }
+
+  std::move(this->stackTop - argCount - 1, this->stackTop, frame->slots);
+  this->stackTop = frame->slots + argCount + 1;
+
+  // The profiler reads the function and ip apart, so the ip is cleared
+  // while they disagree; a null ip samples as the function's entry.
+  this->ip = nullptr;
+  std::atomic_signal_fence(std::memory_order_release);
+  this->frame->function = function;
+  std::atomic_signal_fence(std::memory_order_release);
+  this->ip = function->chunk.codes.data();
+}
+
+// Records one trip around a hot loop, starting at its header, by running
+// the loop body an instruction at a time and noting operand types and
+// branch directions. Stops early, leaving the interpreter wherever it got
+// to, at anything the trace interpreter can't handle.
+InterpretResult VM::recordTrace(LoopSite &site) {
+  constexpr size_t MAX_TRACE_LENGTH = 1024;
+
+  Chunk &chunk = frame->function->chunk;
+  uint8_t *header = this->ip;
+  std::vector<RecordedInstruction> path;
+  size_t remaining = this->budget;
+  InterpretResult result = INTERPRET_SUSPENDED;
+  bool closed = false;
+
+  while (path.size() < MAX_TRACE_LENGTH && remaining > 0) {
+    uint8_t op = *this->ip;
+    RecordedInstruction recorded{
+        static_cast<uint32_t>(this->ip - chunk.codes.data())};
+    if (op == OP_LOOP) {
+      uint16_t distance = static_cast<uint16_t>((ip[1] << 8) | ip[2]);
+      path.push_back(recorded);
+      closed = this->ip + 5 - distance == header;
+      if (closed) {
+        break;
+      }
+      // Another back edge on the way round, such as the jump from a for
+      // loop's increment to its condition. Take it without counting it, so
+      // no second recording starts inside this one.
+      this->ip += 5 - distance;
+      remaining--;
+      continue;
+    }
+    if (!isTraceable(op)) {
+      break;
+    }
+
+    if (op == OP_NEGATE) {
+      recorded.numeric = isNumber(peek(0));
+    } else if (op >= OP_GREATER && op <= OP_DIVIDE) {
+      recorded.numeric = isNumber(peek(0)) && isNumber(peek(1));
+    }
+
+    this->budget = 1;
+    result = run();
+    remaining--;
+    if (result != INTERPRET_SUSPENDED) {
+      break;
+    }
+    if (op == OP_JUMP_IF_FALSE) {
+      recorded.taken = this->ip != chunk.codes.data() + recorded.offset + 3;
+    }
+    path.push_back(recorded);
+  }
+
+  this->budget = remaining;
+  if (result == INTERPRET_RUNTIME_ERROR) {
+    return result;
+  }
+  if (!closed || !compileTrace(chunk, path, site)) {
+    site.failures++;
+  }
+  return INTERPRET_OK;
+}
+
+namespace {
+// What OperandKind::Nil, True and False stand for, in that order.
+Value const LITERALS[] = {Nil{}, true, false};
+// Lets the trace's lambdas take the op as a compile-time argument.
+template <NumberOp op> using Op = std::integral_constant<NumberOp, op>;
+} // namespace
+
+// Runs a loop's compiled trace from the loop header until a guard fails or
+// the instruction budget can't cover another trip, then points ip at the
+// bytecode the interpreter should carry on from. Returns whether at least
+// one whole trip ran.
+bool VM::runTrace(LoopSite const &site) {
+  Chunk &chunk = frame->function->chunk;
+  TraceInstruction const *start = chunk.traces.data() + site.traceStart;
+  TraceInstruction const *instruction = start;
+  Value const *constants = chunk.constants.data();
+  Value *slots = frame->slots;
+  bool looped = false;
+
+  // Operands are looked up in a table rather than switched on, which keeps
+  // the trace's only unpredictable branch the dispatch on its op.
+  auto operand = [&](Operand const &operand, int depth) -> Value const & {
+    Value const *bases[] = {this->stackTop - 1 - depth, slots, constants,
+                            LITERALS, LITERALS + 1, LITERALS + 2};
+    return bases[static_cast<size_t>(operand.kind)][operand.index];
+  };
+  auto onStack = [](Operand const &operand) {
+    return operand.kind == OperandKind::Stack ? 1 : 0;
+  };
+  // Operands are read before anything is popped so a side exit leaves the
+  // stack untouched. The result goes straight into the slot it is pushed
+  // to, which numberOp only writes once it has read both operands.
+  auto arithmetic = [&](auto op) {
+    Value *result =
+        this->stackTop - onStack(instruction->a) - onStack(instruction->b);
+    if (!numberOp<decltype(op)::value>(
+            operand(instruction->a, onStack(instruction->b)),
+            operand(instruction->b, 0), *result)) {
+      return false;
+    }
+    this->stackTop = result + 1;
+    return true;
+  };
+  // Pushes a comparison's result, or checks it against the recorded
+  // direction of the branch fused into it.
+  auto test = [&](bool result) {
+    if (instruction->branch == TraceBranch::None) {
+      push(result);
+      return true;
+    }
+    return result == (instruction->branch == TraceBranch::ExpectTrue);
+  };
+  auto compare = [&](auto op) {
+    Value result;
+    if (!numberOp<decltype(op)::value>(
+            operand(instruction->a, onStack(instruction->b)),
+            operand(instruction->b, 0), result)) {
+      return false;
+    }
+    Value *top = this->stackTop;
+    this->stackTop -= onStack(instruction->a) + onStack(instruction->b);
+    if (!test(*std::get_if<bool>(&result))) {
+      this->stackTop = top;
+      return false;
+    }
+    return true;
+  };
+
+  for (;; instruction++) {
+    switch (instruction->op) {
+    case TraceOp::PUSH:
+      push(operand(instruction->a, 0));
+      break;
+    case TraceOp::ADD:
+      if (!arithmetic(Op<NumberOp::Add>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::SUBTRACT:
+      if (!arithmetic(Op<NumberOp::Subtract>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::MULTIPLY:
+      if (!arithmetic(Op<NumberOp::Multiply>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::DIVIDE:
+      if (!arithmetic(Op<NumberOp::Divide>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::LESS:
+      if (!compare(Op<NumberOp::Less>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::GREATER:
+      if (!compare(Op<NumberOp::Greater>{})) {
+        goto exit;
+      }
+      break;
+    case TraceOp::EQUAL: {
+      bool equal =
+          valuesEqual(operand(instruction->a, onStack(instruction->b)),
+                      operand(instruction->b, 0));
+      Value *top = this->stackTop;
+      this->stackTop -= onStack(instruction->a) + onStack(instruction->b);
+      if (!test(equal)) {
+        this->stackTop = top;
+        goto exit;
+      }
+      break;
+    }
+    case TraceOp::NOT: {
+      bool falsey = isFalsey(operand(instruction->a, 0));
+      this->stackTop -= onStack(instruction->a);
+      push(falsey);
+      break;
+    }
+    case TraceOp::NEGATE: {
+      Value negated;
+      if (!negateNumber(operand(instruction->a, 0), negated)) {
+        goto exit;
+      }
+      this->stackTop -= onStack(instruction->a);
+      push(negated);
+      break;
+    }
+    case TraceOp::GUARD: {
+      Value value = operand(instruction->a, 0);
+      if (isFalsey(value) !=
+          (instruction->branch == TraceBranch::ExpectFalse)) {
+        goto exit;
+      }
+      // The interpreter's jump leaves the value on the stack.
+      if (instruction->pop) {
+        this->stackTop -= onStack(instruction->a);
+      } else if (!onStack(instruction->a)) {
+        push(value);
+      }
+      break;
+    }
+    case TraceOp::GET_GLOBAL: {
+      Global &global = globals[instruction->index];
+      if (!global.defined) {
+        goto exit;
+      }
+      push(global.value);
+      break;
+    }
+    case TraceOp::SET_GLOBAL: {
+      Global &global = globals[instruction->index];
+      if (!global.defined) {
+        goto exit;
+      }
+      global.value = operand(instruction->a, 0);
+      if (instruction->pop) {
+        this->stackTop -= onStack(instruction->a);
+      } else if (!onStack(instruction->a)) {
+        push(global.value);
+      }
+      break;
+    }
+    case TraceOp::SET_LOCAL: {
+      Value value = operand(instruction->a, 0);
+      slots[instruction->index] = value;
+      if (instruction->pop) {
+        this->stackTop -= onStack(instruction->a);
+      } else if (!onStack(instruction->a)) {
+        push(value);
+      }
+      break;
+    }
+    case TraceOp::POPN:
+      this->stackTop -= instruction->index;
+      break;
+    case TraceOp::PRINT:
+      printValue(out, operand(instruction->a, 0));
+      out.put('\n');
+      this->stackTop -= onStack(instruction->a);
+      break;
+    case TraceOp::LOOP:
+      if (this->budget < site.instructionCount) {
+        goto exit;
+      }
+      this->budget -= site.instructionCount;
+      looped = true;
+      instruction = start - 1;
+      break;
+    }
+  }
+
+exit:
+  this->ip = chunk.codes.data() + instruction->exit;
+  return looped;
 }
 
 InterpretResult VM::run() {
   for (;;) {
+    if (this->budget == 0) {
+      return INTERPRET_SUSPENDED;
+    }
+    this->budget--;
+
 #ifdef DEBUG_TRACE_EXECUTION
-    std::printf("          ");
-    for (auto slot : this->stack) {
-      std::printf("[ ");
-      printValue(slot);
-      std::printf(" ]");
+    out.write("          ");
+    for (Value *slot = this->stack.data(); slot < this->stackTop; slot++) {
+      out.write("[ ");
+      printValue(out, *slot);
+      out.write(" ]");
     }
-    std::printf("\n");
+    out.put('\n');
 
-    auto start = this->chunk.codes.data();
-    size_t offset = this->ip - start;
+    Chunk &chunk = this->frame->function->chunk;
+    size_t offset = this->ip - chunk.codes.data();
 
-    disassembleInstruction(this->chunk, offset);
+    disassembleInstruction(out, chunk, offset);
 
 #endif
 
@@ -77,39 +575,196 @@ InterpretResult VM::run() {
         break;
       }
       case OP_GREATER:
-        this->binaryOp<std::greater<double>>();
+        this->binaryOp<NumberOp::Greater>();
         break;
       case OP_LESS:
-        this->binaryOp<std::less<double>>();
+        this->binaryOp<NumberOp::Less>();
         break;
       case OP_ADD:
-        this->binaryOp<std::plus<double>>();
+        if (isString(peek(0)) && isString(peek(1))) {
+          concatenate();
+          break;
+        }
+        this->binaryOp<NumberOp::Add>();
         break;
       case OP_SUBTRACT:
-        this->binaryOp<std::minus<double>>();
+        this->binaryOp<NumberOp::Subtract>();
         break;
       case OP_MULTIPLY:
-        this->binaryOp<std::multiplies<double>>();
+        this->binaryOp<NumberOp::Multiply>();
         break;
       case OP_DIVIDE:
-        this->binaryOp<std::divides<double>>();
+        this->binaryOp<NumberOp::Divide>();
         break;
       case OP_NOT:
         push(isFalsey(pop()));
         break;
       case OP_NEGATE: {
-        if (double const *value = std::get_if<double>(&this->stack.back())) {
-          this->stack.back() = -*value;
-        } else {
+        if (!negateNumber(this->stackTop[-1], this->stackTop[-1])) {
           runtimeError("Operand must be a number.");
           return INTERPRET_RUNTIME_ERROR;
         }
         break;
       }
-      case OP_RETURN:
-        printValue(this->pop());
-        std::cout << "\n";
-        return INTERPRET_OK;
+      case OP_PRINT:
+        printValue(out, this->pop());
+        out.put('\n');
+        break;
+      case OP_POP:
+        this->stackTop--;
+        break;
+      case OP_POPN:
+        this->stackTop -= readByte();
+        break;
+      case OP_DEFINE_GLOBAL: {
+        Global &global = globals[readShort()];
+        global.value = pop();
+        global.defined = true;
+        break;
+      }
+      case OP_GET_GLOBAL: {
+        Global &global = globals[readShort()];
+        if (!global.defined) {
+          throw std::runtime_error("Undefined variable '" +
+                                   std::string{global.name->chars} + "'.");
+        }
+        push(global.value);
+        break;
+      }
+      case OP_SET_GLOBAL: {
+        Global &global = globals[readShort()];
+        if (!global.defined) {
+          throw std::runtime_error("Undefined variable '" +
+                                   std::string{global.name->chars} + "'.");
+        }
+        global.value = peek(0);
+        break;
+      }
+      case OP_GET_LOCAL:
+        push(frame->slots[readByte()]);
+        break;
+      case OP_SET_LOCAL:
+        frame->slots[readByte()] = peek(0);
+        break;
+      case OP_GET_LOCAL_LONG:
+        push(frame->slots[readShort()]);
+        break;
+      case OP_SET_LOCAL_LONG:
+        frame->slots[readShort()] = peek(0);
+        break;
+      case OP_JUMP: {
+        uint16_t offset = readShort();
+        this->ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_FALSE: {
+        uint16_t offset = readShort();
+        if (isFalsey(peek(0))) {
+          this->ip += offset;
+        }
+        break;
+      }
+      case OP_LOOP: {
+        uint16_t offset = readShort();
+        LoopSite &site = frame->function->chunk.loops[readShort()];
+        this->ip -= offset;
+        if (site.traceLength != 0) {
+          // A trace that keeps leaving before the end of its first trip
+          // follows a path the loop no longer takes, so record it afresh.
+          if (runTrace(site)) {
+            site.hits = 0;
+          } else if (++site.hits == LoopSite::HOT) {
+            site.hits = 0;
+            site.traceLength = 0;
+            site.failures++;
+          }
+        } else if (site.failures < LoopSite::MAX_FAILURES &&
+                   ++site.hits == LoopSite::HOT) {
+          site.hits = 0;
+          if (recordTrace(site) == INTERPRET_RUNTIME_ERROR) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+        }
+        break;
+      }
+      case OP_CALL: {
+        int argCount = readByte();
+        callValue(peek(argCount), argCount);
+        break;
+      }
+      case OP_TAIL_CALL:
+        tailCall(readByte());
+        break;
+      case OP_CLASS:
+        push(heap.allocate<ObjClass>(readString()));
+        break;
+      case OP_METHOD:
+        defineMethod(readString());
+        break;
+      case OP_GET_PROPERTY: {
+        ObjString *name = readString();
+        InlineCache &cache = readCache();
+        Value receiver = peek(0);
+        if (!isInstance(receiver)) {
+          throw std::runtime_error("Only instances have properties.");
+        }
+
+        ObjInstance *instance = asInstance(receiver);
+        CacheEntry const *entry = cache.find(instance->shape);
+        if (entry != nullptr && entry->method == nullptr) {
+          this->stackTop[-1] = instance->fields[entry->slot];
+          break;
+        }
+        getProperty(name, cache);
+        break;
+      }
+      case OP_SET_PROPERTY: {
+        ObjString *name = readString();
+        InlineCache &cache = readCache();
+        Value receiver = peek(1);
+        if (!isInstance(receiver)) {
+          throw std::runtime_error("Only instances have fields.");
+        }
+
+        ObjInstance *instance = asInstance(receiver);
+        CacheEntry const *entry = cache.find(instance->shape);
+        if (entry != nullptr && entry->transition == nullptr) {
+          instance->fields[entry->slot] = peek(0);
+        } else if (entry != nullptr) {
+          instance->shape = entry->transition;
+          instance->fields.push_back(peek(0));
+        } else {
+          setProperty(name, cache);
+        }
+
+        Value value = pop();
+        this->stackTop[-1] = value;
+        break;
+      }
+      case OP_INVOKE: {
+        ObjString *name = readString();
+        int argCount = readByte();
+        invoke(name, argCount, readCache());
+        break;
+      }
+      case OP_RETURN: {
+        Value result = pop();
+        Value *slots = frame->slots;
+        this->frameCount--;
+        // The popped frame is reused by the next call only after this.
+        std::atomic_signal_fence(std::memory_order_release);
+        if (this->frameCount == 0) {
+          this->stackTop = this->stack.data();
+          this->frame = nullptr;
+          return INTERPRET_OK;
+        }
+
+        this->stackTop = slots;
+        push(result);
+        this->frame = &this->frames[this->frameCount - 1];
+        this->ip = this->frame->ip;
+        break;
+      }
       }
 
     } catch (std::runtime_error e) {
@@ -119,34 +774,158 @@ InterpretResult VM::run() {
   }
 }
 
+void VM::invoke(ObjString *name, int argCount, InlineCache &cache) {
+  Value receiver = peek(argCount);
+  if (!isInstance(receiver)) {
+    throw std::runtime_error("Only instances have methods.");
+  }
+
+  ObjInstance *instance = asInstance(receiver);
+  CacheEntry const *entry = cache.find(instance->shape);
+  CacheEntry resolved =
+      entry != nullptr ? *entry : resolveProperty(instance, name);
+  if (entry == nullptr) {
+    cache.add(resolved);
+  }
+
+  if (resolved.method != nullptr) {
+    return call(resolved.method, argCount);
+  }
+
+  // A field holding a callable shadows any method of the same name.
+  Value field = instance->fields[resolved.slot];
+  this->stackTop[-argCount - 1] = field;
+  callValue(field, argCount);
+}
+
+// Slow path of OP_GET_PROPERTY: a cache miss, or a hit on a method that
+// still has to be bound to its receiver.
+void VM::getProperty(ObjString *name, InlineCache &cache) {
+  ObjInstance *instance = asInstance(peek(0));
+  CacheEntry const *entry = cache.find(instance->shape);
+  CacheEntry resolved =
+      entry != nullptr ? *entry : resolveProperty(instance, name);
+  if (entry == nullptr) {
+    cache.add(resolved);
+  }
+
+  if (resolved.method != nullptr) {
+    this->stackTop[-1] =
+        heap.allocate<ObjBoundMethod>(instance, resolved.method);
+  } else {
+    this->stackTop[-1] = instance->fields[resolved.slot];
+  }
+}
+
+CacheEntry VM::resolveProperty(ObjInstance *instance, ObjString *name) {
+  CacheEntry entry{instance->shape};
+
+  int slot = instance->shape->lookup(name);
+  if (slot != -1) {
+    entry.slot = slot;
+    return entry;
+  }
+
+  auto method = instance->klass->methods.find(name);
+  if (method == instance->klass->methods.end()) {
+    throw std::runtime_error("Undefined property '" +
+                             std::string{name->chars} + "'.");
+  }
+  entry.method = method->second;
+  return entry;
+}
+
+void VM::setProperty(ObjString *name, InlineCache &cache) {
+  ObjInstance *instance = asInstance(peek(1));
+  CacheEntry miss{instance->shape};
+
+  int slot = instance->shape->lookup(name);
+  if (slot != -1) {
+    miss.slot = slot;
+    instance->fields[slot] = peek(0);
+  } else {
+    miss.slot = instance->fields.size();
+    miss.transition = instance->shape->transition(name);
+    instance->shape = miss.transition;
+    instance->fields.push_back(peek(0));
+  }
+
+  cache.add(miss);
+}
+
+void VM::defineMethod(ObjString *name) {
+  // The verifier has seen to the method, but the class comes from a
+  // variable.
+  if (!isClass(peek(1))) {
+    throw std::runtime_error("Methods can only be defined on a class.");
+  }
+  ObjFunction *method = asFunction(peek(0));
+  ObjClass *klass = asClass(peek(1));
+  klass->methods[name] = method;
+  if (name == this->initString) {
+    klass->initializer = method;
+  }
+  pop();
+}
+
+void VM::concatenate() {
+  ObjString *b = asString(pop());
+  ObjString *a = asString(pop());
+  push(heap.intern(a->chars + b->chars));
+}
+
 inline uint8_t VM::readByte() { return *this->ip++; }
-inline Value VM::readConstant() { return this->chunk.constants.at(readByte()); }
+inline uint16_t VM::readShort() {
+  this->ip += 2;
+  return static_cast<uint16_t>((this->ip[-2] << 8) | this->ip[-1]);
+}
+inline Value VM::readConstant() {
+  return this->frame->function->chunk.constants[readByte()];
+}
+inline ObjString *VM::readString() { return asString(readConstant()); }
+inline InlineCache &VM::readCache() {
+  return this->frame->function->chunk.caches[readShort()];
+}
 
-void VM::push(Value value) { this->stack.push_back(value); }
+void VM::push(Value value) { *this->stackTop++ = value; }
 
 Value VM::pop() {
-  Value top{this->stack.back()};
-  this->stack.pop_back();
-  return top;
+  return *--this->stackTop;
 }
 
 void VM::init() { resetStack(); }
-void VM::resetStack() { this->stack.clear(); }
+void VM::resetStack() {
+  this->stackTop = this->stack.data();
+  this->frameCount = 0;
+  this->frame = nullptr;
+}
 void VM::runtimeError(std::string message) {
+  out.flush();
   std::cerr << message << "\n";
 
-  size_t instruction = ip - chunk.codes.data() - 1;
-  int line = chunk.lines[instruction];
-  std::cerr << "[line " << line << "] in script\n";
+  for (size_t i = this->frameCount; i-- > 0;) {
+    CallFrame &callFrame = this->frames[i];
+    uint8_t *frameIp = i == this->frameCount - 1 ? this->ip : callFrame.ip;
+    Chunk &chunk = callFrame.function->chunk;
+    size_t instruction = frameIp - chunk.codes.data() - 1;
+    std::cerr << "[line " << chunk.getLine(instruction) << "] in ";
+    if (callFrame.function->name.empty()) {
+      std::cerr << "script\n";
+    } else {
+      std::cerr << callFrame.function->name << "()\n";
+    }
+  }
   resetStack();
 }
 
-Value VM::peek(int distance) { return stack.at(stack.size() - 1 - distance); }
+Value VM::peek(int distance) { return this->stackTop[-1 - distance]; }
 bool isFalsey(Value value) {
   struct FalseyVisitor {
     bool operator()(bool b) { return !b; }
     bool operator()(double) { return false; }
+    bool operator()(int64_t) { return false; }
     bool operator()(Nil) { return true; }
+    bool operator()(Object *) { return false; }
   };
   static FalseyVisitor visitor{};
 
@@ -164,8 +943,16 @@ bool valuesEqual(Value a, Value b) {
     return std::get<bool>(a) == std::get<bool>(b);
   case ValueType::Nil:
     return true;
-  case ValueType::Number:
-    return std::get<double>(a) == std::get<double>(b);
+  case ValueType::Number: {
+    int64_t const *x = std::get_if<int64_t>(&a);
+    int64_t const *y = std::get_if<int64_t>(&b);
+    if (x != nullptr && y != nullptr) {
+      return *x == *y;
+    }
+    return asNumber(a) == asNumber(b);
+  }
+  case ValueType::Object:
+    return std::get<Object *>(a) == std::get<Object *>(b);
   }
 }
 } // namespace lox
\ No newline at end of file
@@ -1,54 +1,176 @@
 #ifndef cpplox_vm_h
 #define cpplox_vm_h
 
+#include <cstdint>
 #include <memory>
 
 #include "chunk.h"
+#include "globals.h"
+#include "memory.h"
+#include "native.h"
+#include "number.h"
+#include "object.h"
 #include "value.h"
-#include <deque>
 #include <stack>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace lox {
 
-inline bool isNumber(Value value) {
-  return std::get_if<double>(&value) != nullptr;
-}
-
 enum InterpretResult {
   INTERPRET_OK,
   INTERPRET_COMPILE_ERROR,
-  INTERPRET_RUNTIME_ERROR
+  INTERPRET_RUNTIME_ERROR,
+  // The instruction budget ran out; resume() continues where it stopped.
+  INTERPRET_SUSPENDED
+};
+
+constexpr size_t DEFAULT_MAX_FRAMES = 256;
+constexpr size_t UNLIMITED_BUDGET = SIZE_MAX;
+
+struct CallFrame {
+  ObjFunction *function;
+  // Return address; the running frame's ip lives in VM::ip.
+  uint8_t *ip;
+  // The frame's slot zero in the value stack.
+  Value *slots;
 };
 
 class VM {
+  friend class AotRuntime;
+  friend class Profiler;
+  friend class Snapshot;
+
 private:
-  Chunk chunk;
-  uint8_t *ip;
-  std::deque<Value> stack;
+  // Declared first: everything below allocates from it.
+  MemoryAccount memory;
+  // Serves the heap's objects and the small buffers they own.
+  SizeClassPool pool;
+  // Sized once to the depth limit so calls never allocate. Like the value
+  // stack, it is a fixed cost of the VM and not charged to the account.
+  std::pmr::vector<CallFrame> frames;
+  size_t frameCount = 0;
+  CallFrame *frame = nullptr;
+  uint8_t *ip = nullptr;
+  // Allocated once. Chunks are verified before they run and call() checks
+  // that a callee's verified maxStack fits, so pushes and pops inside a
+  // frame need no bounds checks.
+  std::pmr::vector<Value> stack;
+  Value *stackTop;
+  // Instructions left before run() suspends.
+  size_t budget = UNLIMITED_BUDGET;
+  Heap heap;
+  Globals globals;
+  ObjString *initString;
+  OutputSink out;
+  bool lazyCompilation = true;
 
   InterpretResult run();
+  void callValue(Value callee, int argCount);
+  void call(ObjFunction *function, int argCount);
+  void callNative(ObjNative *native, int argCount);
+  void bindNative(std::string_view name, size_t arity, NativeThunk thunk,
+                  void (*function)());
+  void tailCall(int argCount);
+  InterpretResult recordTrace(LoopSite &site);
+  bool runTrace(LoopSite const &site);
+  bool stackFits(Value *slots, ObjFunction *function);
+  void invoke(ObjString *name, int argCount, InlineCache &cache);
+  void getProperty(ObjString *name, InlineCache &cache);
+  void setProperty(ObjString *name, InlineCache &cache);
+  CacheEntry resolveProperty(ObjInstance *instance, ObjString *name);
+  void defineMethod(ObjString *name);
+  void concatenate();
   inline uint8_t readByte();
+  inline uint16_t readShort();
   inline Value readConstant();
+  inline ObjString *readString();
+  inline InlineCache &readCache();
   void resetStack();
   void runtimeError(std::string message);
 
-  template <typename Op> void binaryOp() {
-    if (!isNumber(peek(0)) || !isNumber(peek(1))) {
+  template <NumberOp op> void binaryOp() {
+    if (!numberOp<op>(this->stackTop[-2], this->stackTop[-1],
+                      this->stackTop[-2])) {
       throw std::runtime_error("Operand must be a number.");
     }
-
-    auto b = std::get<double>(this->pop());
-    auto a = std::get<double>(this->pop());
-    push(Op()(a, b));
+    this->stackTop--;
   }
 
   Value peek(int distance);
 
 public:
-  InterpretResult interpret(std::string const &src);
+  explicit VM(size_t maxFrames = DEFAULT_MAX_FRAMES);
+
+  // Runs src until it finishes, fails, or has executed budget instructions.
+  // A suspended script keeps its frames and stack; a host can time-slice
+  // many VMs from one event loop by calling resume() on each in turn.
+  // Interpreting new source abandons a suspended script.
+  InterpretResult interpret(std::string const &src,
+                            size_t budget = UNLIMITED_BUDGET);
+  // Compiles src into a script function for interpret() to run, or prints
+  // the errors and returns nullptr; throws MemoryLimitError if the heap
+  // limit runs out. The function stays valid for the VM's lifetime and can
+  // be run any number of times.
+  ObjFunction *compile(std::string const &src);
+  InterpretResult interpret(ObjFunction *script,
+                            size_t budget = UNLIMITED_BUDGET);
+  // Compiles the functions declared in script, however deeply nested, that
+  // are still waiting for their first call, so running it never needs the
+  // compiler. Throws std::runtime_error if a body doesn't compile.
+  void compileFunctions(ObjFunction *script);
+  // Continues a suspended script for up to budget more instructions.
+  // Returns INTERPRET_OK if nothing is suspended.
+  InterpretResult resume(size_t budget = UNLIMITED_BUDGET);
+  bool suspended() const { return this->frameCount != 0; }
+  // Whether interpret() defers compiling function bodies to their first
+  // call; see lazy.h. On by default.
+  void setLazyCompilation(bool lazy) { this->lazyCompilation = lazy; }
+  // Where print statements go; standard output unless replaced. Output is
+  // buffered and flushed when interpret() returns, on flush(), before a
+  // channel builtin waits, and at each newline if the sink is line buffered.
+  OutputSink &output() { return out; }
+  void setOutput(OutputSink sink);
+  // Byte counts for everything this VM has allocated, and the hard limit
+  // past which allocation fails with a runtime error.
+  MemoryAccount &memoryAccount() { return memory; }
+  // Where the VM's objects live, for natives that take VM & to allocate
+  // their results in.
+  Heap &objects() { return heap; }
+  // Occupancy and fragmentation of the heap's size-class pool.
+  PoolStats heapStats() const { return pool.stats(); }
+  // Binds a C++ function to a global, for example
+  //   vm.defineNative("hypot", static_cast<double (*)(double, double)>(
+  //                                std::hypot));
+  // Captureless lambdas bind with a leading +. The arity check and the
+  // argument and result conversions are generated from the signature; see
+  // NativeType for the types that convert. A function whose first
+  // parameter is Heap & is passed the VM's heap, to allocate its result in,
+  // and one whose first parameter is VM & is passed the VM.
+  template <typename R, typename... Args>
+  void defineNative(std::string_view name, R (*function)(Args...)) {
+    static_assert(sizeof...(Args) <= UINT8_MAX, "Too many parameters.");
+    bindNative(name, sizeof...(Args), &lox::callNative<R, Args...>,
+               reinterpret_cast<void (*)()>(function));
+  }
+  template <typename R, typename... Args>
+  void defineNative(std::string_view name, R (*function)(Heap &, Args...)) {
+    static_assert(sizeof...(Args) <= UINT8_MAX, "Too many parameters.");
+    bindNative(name, sizeof...(Args), &lox::callNativeWithHeap<R, Args...>,
+               reinterpret_cast<void (*)()>(function));
+  }
+  template <typename R, typename... Args>
+  void defineNative(std::string_view name, R (*function)(VM &, Args...)) {
+    static_assert(sizeof...(Args) <= UINT8_MAX, "Too many parameters.");
+    bindNative(name, sizeof...(Args), &lox::callNativeWithVM<R, Args...>,
+               reinterpret_cast<void (*)()>(function));
+  }
+  // Binds a channel to a global. Binding the same channel in several VMs,
+  // each run on its own thread, lets their scripts exchange messages.
+  void defineChannel(std::string_view name, std::shared_ptr<Channel> channel);
   void init();
   void push(Value);
   Value pop();